@@ -15,72 +15,97 @@ namespace srsli {
     {
         EnsureAlignmentIsClipped();
         if (accuracy < 0.1)
-            accuracy = AlignmentAccuracy(Alignment, 0, 1);
+        {
+            size_t total = AlignmentLength();
+            accuracy = (total == 0) ? 0.0 : 100.0*(float)stats.matches/(float)total;
+        }
         return accuracy;
     }
 
-    int AlignmentRecord::UnalignedQueryStartBases()
+    // The alignment's runs of columns, clipped to its anchors
+    const std::vector<CigarUnit>& AlignmentRecord::Cigar()
     {
         EnsureAlignmentIsClipped();
-        if (unalignedQueryStartBases < 0)
-            unalignedQueryStartBases = CountUnalignedStartBases(QueryRow());
-        return unalignedQueryStartBases;
+        return cigar;
     }
 
-    int AlignmentRecord::UnalignedQueryEndBases()
+    // The clipped alignment's columns by type, and its unaligned ends
+    const AlignmentStats& AlignmentRecord::Stats()
     {
         EnsureAlignmentIsClipped();
-        if (unalignedQueryEndBases < 0)
-            unalignedQueryEndBases = CountUnalignedEndBases(QueryRow());
-        return unalignedQueryEndBases;
+        return stats;
     }
 
-    int AlignmentRecord::UnalignedReferenceStartBases()
+    // Take the alignment of the region, from its first column to its last,
+    //    leaving the caller's vector empty
+    void AlignmentRecord::SetCigar(std::vector<CigarUnit>& newCigar)
     {
-        EnsureAlignmentIsClipped();
-        if (unalignedReferenceStartBases < 0)
-            unalignedReferenceStartBases = CountUnalignedStartBases(ReferenceRow());
-        return unalignedReferenceStartBases;
+        cigar.swap(newCigar);
+        newCigar.clear();
+        accuracy = 0.0;
+        hasBeenClipped = false;
     }
 
-    int AlignmentRecord::UnalignedReferenceEndBases()
+    size_t AlignmentRecord::AlignmentLength()
     {
         EnsureAlignmentIsClipped();
-        if (unalignedReferenceEndBases < 0)
-            unalignedReferenceEndBases = CountUnalignedEndBases(ReferenceRow());
-        return unalignedReferenceEndBases;
+        return stats.matches + stats.mismatches + stats.insertions + stats.deletions;
     }
 
     size_t AlignmentRecord::QueryStart()
     {
-        return AlignmentRegion.queryStart + UnalignedQueryStartBases();
+        EnsureAlignmentIsClipped();
+        return AlignmentRegion.queryStart + stats.queryStartClip;
     }
 
     size_t AlignmentRecord::QueryEnd()
     {
-        return AlignmentRegion.queryEnd - UnalignedQueryEndBases();
+        EnsureAlignmentIsClipped();
+        return AlignmentRegion.queryEnd - stats.queryEndClip;
     }
 
     size_t AlignmentRecord::ReferenceStart()
     {
-        return AlignmentRegion.refStart + UnalignedReferenceStartBases();
+        EnsureAlignmentIsClipped();
+        return AlignmentRegion.refStart + stats.refStartClip;
     }
 
     size_t AlignmentRecord::ReferenceEnd()
     {
-        return AlignmentRegion.refEnd - UnalignedReferenceEndBases();
+        EnsureAlignmentIsClipped();
+        return AlignmentRegion.refEnd - stats.refEndClip;
     }
 
-    std::string AlignmentRecord::toM1Record()
+    // Build the full SeqAn alignment of the clipped region, for callers that
+    //    need one; the record itself only keeps the runs of columns
+    void AlignmentRecord::BuildAlignment(TAlign& alignment,
+                                         const TDna& querySeq,
+                                         const ReferenceView& refSeq)
+    {
+        TDna refInfix;
+        refSeq.Infix(refInfix, ReferenceStart(), ReferenceEnd());
+
+        resize(rows(alignment), 2);
+        assignSource(row(alignment, 0), infix(querySeq, QueryStart(), QueryEnd()));
+        assignSource(row(alignment, 1), refInfix);
+        CigarToAlign(alignment, Cigar());
+    }
+
+    std::string AlignmentRecord::toM1Record(const ReferenceRecord& refRec)
     {
         char buffer [200];
-        sprintf(buffer, "%s %s %s %s %ld %.4f %zu %zu %zu %zu %zu %zu %zu", 
-                        "QueryName", "ReferenceName", "0", "0", 
-                        Score, Accuracy(),
-                        ReferenceStart(), ReferenceEnd(), ReferenceLength,
-                        QueryStart(), QueryEnd(), QueryLength,
-                        length(QueryRow()));
-        return buffer;
+        snprintf(buffer, sizeof(buffer), " 0 %d %ld %.4f %zu %zu %zu %zu %zu %zu %zu",
+                 refRec.orientation,
+                 Score, Accuracy(),
+                 ReferenceStart(), ReferenceEnd(), ReferenceLength,
+                 QueryStart(), QueryEnd(), QueryLength,
+                 AlignmentLength());
+
+        std::string record = (Query != NULL) ? toCString(Query->Id) : "QueryName";
+        record += ' ';
+        record += toCString(refRec.id);
+        record += buffer;
+        return record;
     }
 
     // Private functions
@@ -88,40 +113,34 @@ namespace srsli {
     {
         if (!hasBeenClipped)
         {
-            ClipAlignment(Alignment);
+            ClipCigar(cigar, stats);
             hasBeenClipped = true;
         }
     }
 
     void AlignmentRecord::Initialize()
     {
+        AlignmentStats empty = { 0, 0, 0, 0, 0, 0, 0, 0 };
         accuracy = 0.0;
         Score = 0L;
-        unalignedQueryStartBases = -1;
-        unalignedQueryEndBases = -1;
-        unalignedReferenceStartBases = -1;
-        unalignedReferenceEndBases = -1;
+        MappingQuality = 255;
+        IsSecondary = false;
+        Query = NULL;
+        stats = empty;
         hasBeenClipped = false;
     }
 
     // Constructors
-    AlignmentRecord::AlignmentRecord(const TDna& querySeq,
-                                     const TDna& refSeq,
+    AlignmentRecord::AlignmentRecord(const size_t queryLength,
+                                     const size_t referenceLength,
+                                     const size_t referenceIndex,
                                      const region_t& alignmentRegion)
     {
-        // Initialize all basic variables
+        // Initialize all basic variables; the alignment itself is set later
         Initialize();
         AlignmentRegion = alignmentRegion;
-        QueryLength = length(querySeq);
-        ReferenceLength = length(refSeq);
-
-        // Infix the supplied sequences to only the required region
-        TSegment queryInfix = RegionToInfix(querySeq, AlignmentRegion, 'H');
-        TSegment refInfix   = RegionToInfix(refSeq, AlignmentRegion, 'V');
-
-        // Initialize the alignment and rows using the infixes
-        resize(rows(Alignment), 2);
-        assignSource(QueryRow(),     queryInfix);
-        assignSource(ReferenceRow(), refInfix);
+        QueryLength = queryLength;
+        ReferenceLength = referenceLength;
+        ReferenceIndex = referenceIndex;
     }
 }
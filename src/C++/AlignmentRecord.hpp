@@ -2,7 +2,12 @@
 
 #pragma once
 
+#include <vector>
+
 #include "config/SeqAnConfig.hpp"
+#include "config/Types.hpp"
+#include "ReferenceView.hpp"
+#include "SequenceReader.hpp"
 
 namespace srsli {
 
@@ -11,10 +16,8 @@ namespace srsli {
     private:
         // Value variables
         float accuracy;
-        int unalignedQueryStartBases;
-        int unalignedQueryEndBases;
-        int unalignedReferenceStartBases;
-        int unalignedReferenceEndBases;
+        AlignmentStats stats;
+        std::vector<CigarUnit> cigar;
 
         // Flag variables
         bool hasBeenClipped;
@@ -22,31 +25,46 @@ namespace srsli {
     private:
         void Initialize();
         void EnsureAlignmentIsClipped();
-        int UnalignedQueryStartBases();
-        int UnalignedQueryEndBases();
-        int UnalignedReferenceStartBases();
-        int UnalignedReferenceEndBases();
 
     public:
-        TAlign Alignment;
         region_t AlignmentRegion;
         size_t QueryLength;
         size_t ReferenceLength;
+        size_t ReferenceIndex;
         long Score;
+        int MappingQuality;
+        bool IsSecondary;
+
+        // The aligned query, owned by its batch, which the ResultWriter keeps
+        //    alive until the record has been written
+        const SequenceRecord* Query;
 
     public:
         float Accuracy();
-        inline TRow& QueryRow() { return row(Alignment, 0); }
-        inline TRow& ReferenceRow() { return row(Alignment, 1); }
+        const std::vector<CigarUnit>& Cigar();
+        const AlignmentStats& Stats();
+        void SetCigar(std::vector<CigarUnit>& newCigar);
+        size_t AlignmentLength();
         size_t QueryStart();
         size_t QueryEnd();
         size_t ReferenceStart();
         size_t ReferenceEnd();
-        std::string toM1Record();
+        void BuildAlignment(TAlign& alignment,
+                            const TDna& querySeq,
+                            const ReferenceView& refSeq);
+        std::string toM1Record(const ReferenceRecord& refRec);
 
     public:
-        AlignmentRecord(const TDna& querySeq,
-                        const TDna& refSeq,
+        AlignmentRecord(const size_t queryLength,
+                        const size_t referenceLength,
+                        const size_t referenceIndex,
                         const region_t& alnRegion);
+
+        // Records own their CIGARs, so they're moved along to the output
+        //    rather than copied
+        AlignmentRecord(AlignmentRecord&&) = default;
+        AlignmentRecord& operator=(AlignmentRecord&&) = default;
+        AlignmentRecord(const AlignmentRecord&) = delete;
+        AlignmentRecord& operator=(const AlignmentRecord&) = delete;
     };
 }
@@ -0,0 +1,142 @@
+// Author: Brett Bowman
+
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+#include <algorithm>
+#include <stdexcept>
+
+#include "BgzfWriter.hpp"
+
+namespace srsli {
+
+    // The most data put in one block, leaving room for it to grow a little
+    //    when incompressible, and the most a compressed block may take up
+    static const size_t BgzfBlockInput = 0xff00;
+    static const size_t BgzfBlockSize = 0x10000;
+    static const size_t BgzfHeaderSize = 18;
+    static const size_t BgzfFooterSize = 8;
+
+    // The empty block that marks the end of a BGZF file
+    static const unsigned char BgzfEof[28] = {
+        0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+        0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+    };
+
+    void BgzfWriter::Write(const char* data, size_t length)
+    {
+        while (length > 0)
+        {
+            size_t take = std::min(length, BgzfBlockInput - current->input.size());
+            current->input.append(data, take);
+            data += take;
+            length -= take;
+            if (current->input.size() == BgzfBlockInput)
+                SubmitCurrent();
+        }
+    }
+
+    void BgzfWriter::Close()
+    {
+        if (closed)
+            return;
+        closed = true;
+        if (!current->input.empty())
+            SubmitCurrent();
+        WriteFinished(0);
+        if (fwrite(BgzfEof, 1, sizeof(BgzfEof), out) != sizeof(BgzfEof) || fflush(out) != 0)
+            throw std::runtime_error("ERROR: Could not write the BGZF output");
+    }
+
+    // Private functions
+    void BgzfWriter::SubmitCurrent()
+    {
+        std::shared_ptr<Block> block = current;
+        int blockLevel = level;
+        inFlight.push_back(block);
+        pool.Submit([block, blockLevel]() {
+            CompressBlock(*block, blockLevel);
+            block->done = true;
+        });
+
+        current = std::make_shared<Block>();
+        current->done = false;
+        current->input.reserve(BgzfBlockInput);
+
+        if (inFlight.size() >= maxInFlight)
+            WriteFinished(maxInFlight / 2);
+    }
+
+    // Wait for no more than maxPending blocks to be left compressing, then
+    //    write out every finished block at the front of the queue
+    void BgzfWriter::WriteFinished(const size_t maxPending)
+    {
+        pool.Wait(maxPending);
+        while (!inFlight.empty() && inFlight.front()->done)
+        {
+            const std::string& output = inFlight.front()->output;
+            if (fwrite(output.data(), 1, output.size(), out) != output.size())
+                throw std::runtime_error("ERROR: Could not write the BGZF output");
+            inFlight.pop_front();
+        }
+    }
+
+    // Deflate one block's input into a gzip member with the BGZF extra field
+    //    giving its size, storing it uncompressed should deflating not help
+    void BgzfWriter::CompressBlock(Block& block, const int level)
+    {
+        static const unsigned char header[BgzfHeaderSize] = {
+            0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff,
+            0x06, 0x00, 0x42, 0x43, 0x02, 0x00, 0x00, 0x00
+        };
+        const std::string& input = block.input;
+        std::string& output = block.output;
+        output.resize(BgzfBlockSize);
+        memcpy(&output[0], header, BgzfHeaderSize);
+
+        size_t compressedSize = 0;
+        for (int blockLevel = level; ; blockLevel = 0)
+        {
+            z_stream stream;
+            memset(&stream, 0, sizeof(stream));
+            if (deflateInit2(&stream, blockLevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                throw std::runtime_error("ERROR: Could not initialize zlib");
+            stream.next_in = (Bytef*)input.data();
+            stream.avail_in = input.size();
+            stream.next_out = (Bytef*)&output[BgzfHeaderSize];
+            stream.avail_out = BgzfBlockSize - BgzfHeaderSize - BgzfFooterSize;
+            int status = deflate(&stream, Z_FINISH);
+            compressedSize = stream.total_out;
+            deflateEnd(&stream);
+            if (status == Z_STREAM_END)
+                break;
+            if (blockLevel == 0)
+                throw std::runtime_error("ERROR: Could not compress a BGZF block");
+        }
+
+        size_t blockSize = BgzfHeaderSize + compressedSize + BgzfFooterSize;
+        uint32_t crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef*)input.data(), input.size());
+        uint32_t inputSize = input.size();
+        output[16] = (blockSize - 1) & 0xff;
+        output[17] = (blockSize - 1) >> 8;
+        for (int i = 0; i < 4; ++i)
+        {
+            output[BgzfHeaderSize + compressedSize + i] = (crc >> (8 * i)) & 0xff;
+            output[BgzfHeaderSize + compressedSize + 4 + i] = (inputSize >> (8 * i)) & 0xff;
+        }
+        output.resize(blockSize);
+    }
+
+    // Constructors
+    BgzfWriter::BgzfWriter(FILE* out_, const size_t numThreads, const int level_)
+        : out( out_ )
+        , level( level_ )
+        , pool( numThreads )
+        , maxInFlight( 4 * pool.Size() )
+        , current( std::make_shared<Block>() )
+        , closed( false )
+    {
+        current->done = false;
+        current->input.reserve(BgzfBlockInput);
+    }
+}
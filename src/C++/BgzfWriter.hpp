@@ -0,0 +1,53 @@
+// Author: Brett Bowman
+
+#pragma once
+
+#include <stdio.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+
+#include "ThreadPool.hpp"
+
+namespace srsli {
+
+    /// Writes a BGZF file, as used by BAM: a series of independently
+    ///   deflated gzip blocks of up to 64KB each, closed by an empty block.
+    ///   Blocks are compressed in parallel on a pool of their own and
+    ///   written out in order, keeping a couple per thread in flight
+    class BgzfWriter {
+
+    private:
+        struct Block {
+            std::string input;
+            std::string output;
+            std::atomic<bool> done;
+        };
+
+        FILE* out;
+        const int level;
+        ThreadPool pool;
+        const size_t maxInFlight;
+        std::shared_ptr<Block> current;
+        std::deque<std::shared_ptr<Block>> inFlight;
+        bool closed;
+
+    private:
+        void SubmitCurrent();
+        void WriteFinished(const size_t maxPending);
+        static void CompressBlock(Block& block, const int level);
+
+    public:
+        void Write(const char* data, size_t length);
+
+        // Write out every block, then the end-of-file marker
+        void Close();
+
+    public:
+        BgzfWriter(FILE* out, const size_t numThreads, const int level = 6);
+
+        BgzfWriter(const BgzfWriter&) = delete;
+        BgzfWriter& operator=(const BgzfWriter&) = delete;
+    };
+}
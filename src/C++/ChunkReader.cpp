@@ -0,0 +1,215 @@
+// Author: Brett Bowman
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
+
+#include "ChunkReader.hpp"
+
+namespace srsli {
+
+    // How much plain or gzipped input to hand over at a time, and how much
+    //    compressed input to feed zlib at a time
+    static const size_t ChunkSize = 4 << 20;
+    static const size_t GzipInputSize = 1 << 20;
+
+    // BGZF blocks are gzip members with a 'BC' extra field giving their size
+    static const size_t BgzfHeaderSize = 18;
+    static const size_t BgzfFooterSize = 8;
+    static const size_t BgzfBlocksPerThread = 16;
+
+    static bool IsBgzfHeader(const std::string& header)
+    {
+        const unsigned char* bytes = (const unsigned char*)header.data();
+        return header.size() == BgzfHeaderSize &&
+               bytes[0] == 0x1f && bytes[1] == 0x8b && (bytes[3] & 0x04) &&
+               bytes[12] == 'B' && bytes[13] == 'C';
+    }
+
+    bool ChunkReader::Read(std::string& chunk)
+    {
+        // Skip over any empty pieces, such as the BGZF end-of-file block
+        while (true)
+        {
+            bool more;
+            switch (compression) {
+                case Gzip: more = ReadGzip(chunk); break;
+                case Bgzf: more = ReadBgzf(chunk); break;
+                default:   more = ReadPlain(chunk); break;
+            }
+            if (!chunk.empty())
+                return true;
+            if (!more)
+                return false;
+        }
+    }
+
+    // Private functions
+    size_t ChunkReader::ReadRaw(char* buffer, const size_t length)
+    {
+        size_t fromPending = std::min(length, pending.size() - pendingPos);
+        memcpy(buffer, pending.data() + pendingPos, fromPending);
+        pendingPos += fromPending;
+
+        size_t fromFile = fread(buffer + fromPending, 1, length - fromPending, in);
+        if (fromFile < length - fromPending && ferror(in))
+            throw std::runtime_error("ERROR: Could not read the query file");
+        return fromPending + fromFile;
+    }
+
+    bool ChunkReader::ReadPlain(std::string& chunk)
+    {
+        chunk.resize(ChunkSize);
+        chunk.resize(ReadRaw(&chunk[0], ChunkSize));
+        return !chunk.empty();
+    }
+
+    bool ChunkReader::ReadGzip(std::string& chunk)
+    {
+        chunk.resize(ChunkSize);
+        stream.next_out = (Bytef*)&chunk[0];
+        stream.avail_out = ChunkSize;
+        while (stream.avail_out > 0)
+        {
+            if (stream.avail_in == 0)
+            {
+                size_t inputSize = ReadRaw(&input[0], input.size());
+                if (inputSize == 0)
+                {
+                    if (!memberDone)
+                        throw std::runtime_error("ERROR: The gzipped query file is truncated");
+                    break;
+                }
+                stream.next_in = (Bytef*)&input[0];
+                stream.avail_in = inputSize;
+            }
+
+            // Concatenated gzip files are read as one, member after member
+            if (memberDone)
+            {
+                inflateReset(&stream);
+                memberDone = false;
+            }
+
+            int status = inflate(&stream, Z_NO_FLUSH);
+            if (status == Z_STREAM_END)
+                memberDone = true;
+            else if (status != Z_OK && status != Z_BUF_ERROR)
+                throw std::runtime_error("ERROR: Could not inflate the gzipped query file");
+        }
+        chunk.resize(ChunkSize - stream.avail_out);
+        return !chunk.empty();
+    }
+
+    // Read the next group of blocks, setting each one inflating as soon as
+    //    it's read, then join their contents up in order
+    bool ChunkReader::ReadBgzf(std::string& chunk)
+    {
+        size_t numBlocks = 0;
+        while (numBlocks < blocks.size() && !atEnd)
+        {
+            Block& block = blocks[numBlocks];
+            block.compressed.resize(BgzfHeaderSize);
+            size_t headerSize = ReadRaw(&block.compressed[0], BgzfHeaderSize);
+            if (headerSize == 0)
+            {
+                atEnd = true;
+                break;
+            }
+            block.compressed.resize(headerSize);
+            if (!IsBgzfHeader(block.compressed))
+                throw std::runtime_error("ERROR: Malformed BGZF block in the query file");
+
+            const unsigned char* header = (const unsigned char*)block.compressed.data();
+            size_t blockSize = (header[16] | (header[17] << 8)) + 1;
+            if (blockSize < BgzfHeaderSize + BgzfFooterSize)
+                throw std::runtime_error("ERROR: Malformed BGZF block in the query file");
+            block.compressed.resize(blockSize);
+            size_t bodySize = blockSize - BgzfHeaderSize;
+            if (ReadRaw(&block.compressed[BgzfHeaderSize], bodySize) != bodySize)
+                throw std::runtime_error("ERROR: The BGZF query file is truncated");
+
+            Block* toInflate = &block;
+            pool->Submit([toInflate]() { InflateBlock(*toInflate); });
+            ++numBlocks;
+        }
+        pool->Wait();
+
+        chunk.clear();
+        for (size_t i = 0; i < numBlocks; ++i)
+            chunk += blocks[i].output;
+        return numBlocks > 0;
+    }
+
+    void ChunkReader::InflateBlock(Block& block)
+    {
+        const std::string& compressed = block.compressed;
+        const unsigned char* footer = (const unsigned char*)compressed.data() +
+                                      compressed.size() - BgzfFooterSize;
+        uint32_t crc = 0, outputSize = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            crc |= (uint32_t)footer[i] << (8 * i);
+            outputSize |= (uint32_t)footer[4 + i] << (8 * i);
+        }
+
+        block.output.resize(outputSize);
+        z_stream blockStream;
+        memset(&blockStream, 0, sizeof(blockStream));
+        if (inflateInit2(&blockStream, -15) != Z_OK)
+            throw std::runtime_error("ERROR: Could not initialize zlib");
+        blockStream.next_in = (Bytef*)&compressed[BgzfHeaderSize];
+        blockStream.avail_in = compressed.size() - BgzfHeaderSize - BgzfFooterSize;
+        blockStream.next_out = (Bytef*)&block.output[0];
+        blockStream.avail_out = outputSize;
+        int status = inflate(&blockStream, Z_FINISH);
+        size_t inflatedSize = blockStream.total_out;
+        inflateEnd(&blockStream);
+
+        if (status != Z_STREAM_END || inflatedSize != outputSize ||
+                crc32(crc32(0L, Z_NULL, 0), (const Bytef*)block.output.data(), outputSize) != crc)
+            throw std::runtime_error("ERROR: Corrupt BGZF block in the query file");
+    }
+
+    // Constructors
+    ChunkReader::ChunkReader(const std::string& filename, const size_t numThreads)
+        : in( (filename == "-") ? stdin : fopen(filename.c_str(), "rb") )
+        , compression( Plain )
+        , pendingPos( 0 )
+        , streamOpen( false )
+        , memberDone( false )
+        , atEnd( false )
+    {
+        if (in == NULL)
+            throw std::runtime_error("ERROR: Could not open the file " + filename);
+
+        // Tell the compression apart by the first block's header
+        pending.resize(BgzfHeaderSize);
+        pending.resize(fread(&pending[0], 1, BgzfHeaderSize, in));
+        const unsigned char* magic = (const unsigned char*)pending.data();
+        if (IsBgzfHeader(pending))
+        {
+            compression = Bgzf;
+            pool.reset(new ThreadPool(numThreads));
+            blocks.resize(BgzfBlocksPerThread * pool->Size());
+        }
+        else if (pending.size() >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        {
+            compression = Gzip;
+            memset(&stream, 0, sizeof(stream));
+            if (inflateInit2(&stream, 15 + 16) != Z_OK)
+                throw std::runtime_error("ERROR: Could not initialize zlib");
+            streamOpen = true;
+            input.resize(GzipInputSize);
+        }
+    }
+
+    ChunkReader::~ChunkReader()
+    {
+        if (streamOpen)
+            inflateEnd(&stream);
+        if (in != stdin)
+            fclose(in);
+    }
+}
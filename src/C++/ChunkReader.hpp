@@ -0,0 +1,66 @@
+// Author: Brett Bowman
+
+#pragma once
+
+#include <stdio.h>
+#include <zlib.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ThreadPool.hpp"
+
+namespace srsli {
+
+    /// Reads a file, or standard input for "-", in large chunks, inflating
+    ///   it on the way should it be gzipped.  BGZF files, whose blocks
+    ///   inflate independently, are inflated many blocks at a time on a
+    ///   pool of their own, overlapping with the reading of later blocks
+    class ChunkReader {
+
+    private:
+        enum Compression { Plain, Gzip, Bgzf };
+
+        struct Block {
+            std::string compressed;
+            std::string output;
+        };
+
+        FILE* in;
+        Compression compression;
+        // Bytes read while detecting the compression, not yet consumed
+        std::string pending;
+        size_t pendingPos;
+
+        // Streaming gzip state
+        z_stream stream;
+        bool streamOpen;
+        bool memberDone;
+        std::string input;
+
+        // Parallel BGZF state; the pool is declared last so that it stops
+        //    before the blocks its workers inflate into go away
+        std::vector<Block> blocks;
+        bool atEnd;
+        std::unique_ptr<ThreadPool> pool;
+
+    private:
+        size_t ReadRaw(char* buffer, const size_t length);
+        bool ReadPlain(std::string& chunk);
+        bool ReadGzip(std::string& chunk);
+        bool ReadBgzf(std::string& chunk);
+        static void InflateBlock(Block& block);
+
+    public:
+        // Replace chunk with the next piece of the file's contents, or
+        //    return false once they're all read
+        bool Read(std::string& chunk);
+
+    public:
+        ChunkReader(const std::string& filename, const size_t numThreads);
+        ~ChunkReader();
+
+        ChunkReader(const ChunkReader&) = delete;
+        ChunkReader& operator=(const ChunkReader&) = delete;
+    };
+}
@@ -3,7 +3,9 @@
 
 #include <iostream>
 #include <stdbool.h>
+#include <stdint.h>
 #include <math.h>
+#include <algorithm>
 #include <map>
 #include <vector>
 #include <typeinfo>
@@ -17,54 +19,262 @@
 #include "config/SeqAnConfig.hpp"
 #include "config/Types.hpp"
 #include "ReferenceSet.hpp"
+#include "QGramIndex.hpp"
+#include "MinimizerIndex.hpp"
+#include "utils/Kmer.cpp"
 
 using namespace seqan;
+using namespace srsli;
 
-// Find seeds using the index
+// Append one SeedHit per index hit to the flat hit buffer.  Overlapping hits
+//    on a diagonal are merged later, once they have all been sorted together
+template<typename TConfig, typename THit>
+void AddSeedHits(std::vector<SeedHit>& seeds,
+                 const THit* begin,
+                 const THit* end,
+                 const size_t qPos,
+                 const float score,
+                 const size_t seqCount,
+                 const ReferenceSet& refSet,
+                 const bool onReverse)
+{
+    for (const THit* hit = begin; hit != end; ++hit)
+    {
+        // Find the reference position, translating forward-strand hits of
+        //    the query's reverse complement onto the matching reverse record
+        size_t refSeq = hit->seq;
+        size_t refPos = hit->pos;
+        if (onReverse)
+        {
+            refPos = refSet.Records[refSeq].seq.Length() - refPos - TConfig::Size;
+            refSeq += seqCount;
+        }
+        seeds.push_back(SeedHit(refSeq, qPos, refPos, TConfig::Size, score));
+    }
+}
+
+// Look up one query Qgram, given its hash and that of its reverse complement,
+//    and add a seed for each hit.  Returns the number of hits
+template<typename TConfig>
+size_t AddQGramSeeds(std::vector<SeedHit>& seeds,
+                     const QGramIndex<TConfig>& index,
+                     const ReferenceSet& refSet,
+                     const size_t qPos,
+                     const uint64_t hash,
+                     const uint64_t rcHash)
+{
+    typedef typename QGramIndex<TConfig>::TSAValue TSAValue;
+    typedef std::pair<const TSAValue*, const TSAValue*> THits;
+
+    // A forward-only index finds the reverse-strand hits under the reverse complement
+    THits hits   = index.Occurrences(hash);
+    THits rcHits = index.ForwardOnly() ? index.Occurrences(rcHash)
+                                       : THits(hits.second, hits.second);
+    size_t count = (hits.second - hits.first) + (rcHits.second - rcHits.first);
+
+    // Skip this Qgram if it doesn't exist in the reference
+    if (count == 0)
+        return 0;
+
+    // Compute the score for the seed based on it's frequency in the reference,
+    //    which counts both strands either way
+    float frequency = float(count)/float(refSet.Size());
+    float score = log( 1.0/frequency );
+
+    AddSeedHits<TConfig>(seeds, hits.first, hits.second, qPos, score,
+                         refSet.Length(), refSet, false);
+    AddSeedHits<TConfig>(seeds, rcHits.first, rcHits.second, qPos, score,
+                         refSet.Length(), refSet, true);
+    return count;
+}
+
+// Mark the query Kmers that lie in low-quality stretches, by their start.  A
+//    base is low-quality when the mean quality of the window of bases
+//    centred on it, clipped to the query, falls below minQuality, so a
+//    window of 1 judges each base alone.  To stay centred, an even window
+//    is rounded up to the next odd size.  A Kmer covering any low-quality
+//    base is skipped.  Queries without qualities keep every Kmer.  Returns
+//    how many Kmers were skipped that would otherwise have been looked up,
+//    i.e. that contain no N
+size_t MaskLowQualityKmers(std::vector<uint8_t>& skip,
+                           const Dna5String& query,
+                           const CharString& qual,
+                           const size_t kmerSize,
+                           const int minQuality,
+                           const size_t window)
+{
+    const long n = length(query);
+    skip.assign(n, 0);
+    if (minQuality <= 0 || (long)length(qual) != n || n < (long)kmerSize)
+        return 0;
+
+    const long half = window / 2;
+    long sum = 0, lastLow = -1, lastN = -1;
+    size_t numSkipped = 0;
+    for (long i = 0; i < std::min(half, n); ++i)
+        sum += (unsigned char)qual[i] - 33;
+    for (long i = 0; i < n; ++i)
+    {
+        // Slide the window along to centre on base i
+        if (i + half < n)
+            sum += (unsigned char)qual[i + half] - 33;
+        if (i - half > 0)
+            sum -= (unsigned char)qual[i - half - 1] - 33;
+        long count = std::min(i + half, n - 1) - std::max(i - half, 0L) + 1;
+        if (sum < (long)minQuality * count)
+            lastLow = i;
+        if (ordValue(query[i]) > 3)
+            lastN = i;
+
+        // The Kmer ending at base i is skipped if it covers a low base
+        long start = i + 1 - (long)kmerSize;
+        if (start >= 0 && lastLow >= start)
+        {
+            skip[start] = 1;
+            if (lastN < start)
+                ++numSkipped;
+        }
+    }
+    return numSkipped;
+}
+
+// Find seeds using the index.  The index must already be built, since
+//    it is only read here and may be shared between threads.  Kmers marked
+//    in skip, if given, aren't looked up.  Returns the number of hits found
 template<typename TConfig = FindSeedsConfig<>>
-void FindSeeds(std::vector<TSeedSet>& seeds,
-               Index<StringSet<Dna5String>, typename TConfig::IndexType>& index,
-               const size_t& refSize,
-               const Dna5String& query)
+size_t FindSeeds(std::vector<SeedHit>& seeds,
+                 const QGramIndex<TConfig>& index,
+                 const ReferenceSet& refSet,
+                 const Dna5String& query,
+                 const uint8_t* skip = NULL)
 {
-    typedef Shape<Dna5, typename TConfig::ShapeType> TShape;
-    typedef StringSet<Dna5String> TStringSet;
-    typedef Index<TStringSet, typename TConfig::IndexType> TIndex;
-    typedef Finder<TIndex> TFinder;
-    typedef Infix<const Dna5String> TInfix;
-    typedef Iterator<const Dna5String, Standard>::Type TIterator;
-
-    TShape& shape = indexShape(index);
-    hashInit(shape, begin(query, Standard()));
-    for (TIterator it = begin(query, Standard()); it != end(query, Standard()) - 12; ++it)
+    size_t numHits = 0;
+
+    // Hash the query 2 bits per base, the same way the index was built,
+    //    skipping any Qgram that contains an N
+    KmerRoller<TConfig::Size> roller;
+    for (size_t i = 0; i < length(query); ++i)
     {
-        // Hash the current Qgram, then get it's query position and number of hits
-        hashNext(shape, it);
-        size_t qPos  = position(it, query);
-        auto hits    = getOccurrences(index, shape);
-        size_t count = length(hits);
-
-        // Skip this iteration if the Kmer doesn't exist in the reference
-        if (count == 0)
+        if (!roller.Push(ordValue(query[i])))
             continue;
 
-        // Compute the score for the seed based on it's frequency in the reference
-        float frequency = float(count)/float(refSize);
-        float score = log( 1.0/frequency );
+        size_t qPos = i + 1 - TConfig::Size;
+        if (skip != NULL && skip[qPos])
+            continue;
+        numHits += AddQGramSeeds(seeds, index, refSet, qPos, roller.hash, roller.rcHash);
+    }
+    return numHits;
+}
 
-        for (size_t i = 0; i < count; ++i)
+// Reusable buffers for the query hashes computed by FindSeedsDirect
+struct QueryKmerHashes {
+    std::vector<uint32_t> hashes;
+    std::vector<uint32_t> rcHashes;
+    std::vector<uint8_t> valid;
+};
+
+// Find seeds like FindSeeds, but for k <= 16 hash every query Qgram up-front
+//    in one vectorized pass, then look them up with the directory entries
+//    and hits of upcoming buckets prefetched ahead of use
+template<typename TConfig = FindSeedsConfig<>>
+size_t FindSeedsDirect(std::vector<SeedHit>& seeds,
+                       const QGramIndex<TConfig>& index,
+                       const ReferenceSet& refSet,
+                       const Dna5String& query,
+                       QueryKmerHashes& buffers,
+                       const uint8_t* skip = NULL)
+{
+    static_assert(TConfig::Size <= 16, "FindSeedsDirect requires a seed size of 16 or less");
+
+    // How far ahead of the current Qgram to prefetch its directory entry and hits
+    const size_t dirAhead = 16;
+    const size_t hitsAhead = 8;
+
+    size_t n = length(query);
+    if (n < (size_t)TConfig::Size)
+        return 0;
+
+    bool forwardOnly = index.ForwardOnly();
+    buffers.hashes.resize(n);
+    buffers.rcHashes.resize(forwardOnly ? n : 0);
+    buffers.valid.resize(n);
+    const uint32_t* hashes = buffers.hashes.data();
+    const uint32_t* rcHashes = buffers.rcHashes.data();
+
+    // Dna5 stores one ordinal value per byte, so hash straight from the query
+    const uint8_t* ords = reinterpret_cast<const uint8_t*>(begin(query, Standard()));
+    size_t numKmers = HashKmers<TConfig::Size>(ords, n,
+                                               buffers.hashes.data(),
+                                               forwardOnly ? buffers.rcHashes.data() : nullptr,
+                                               buffers.valid.data());
+
+    size_t numHits = 0;
+    for (size_t i = 0; i < numKmers; ++i)
+    {
+        if (i + dirAhead < numKmers)
+        {
+            index.PrefetchBucket(hashes[i + dirAhead]);
+            if (forwardOnly)
+                index.PrefetchBucket(rcHashes[i + dirAhead]);
+        }
+        if (i + hitsAhead < numKmers)
+        {
+            index.PrefetchOccurrences(hashes[i + hitsAhead]);
+            if (forwardOnly)
+                index.PrefetchOccurrences(rcHashes[i + hitsAhead]);
+        }
+
+        if (!buffers.valid[i] || (skip != NULL && skip[i]))
+            continue;
+
+        numHits += AddQGramSeeds(seeds, index, refSet, i, hashes[i],
+                                 forwardOnly ? rcHashes[i] : 0);
+    }
+    return numHits;
+}
+
+// Find seeds against a minimizer index, by sampling the query's minimizers
+//    the same way the reference's were and adding a seed for each of their
+//    hits.  Skipped Kmers still take part in the sampling, so the rest are
+//    sampled as the reference was, but aren't looked up when chosen
+template<typename TConfig = FindSeedsConfig<>>
+size_t FindSeeds(std::vector<SeedHit>& seeds,
+                 const MinimizerIndex<TConfig>& index,
+                 const ReferenceSet& refSet,
+                 const Dna5String& query,
+                 const uint8_t* skip = NULL)
+{
+    typedef typename MinimizerIndex<TConfig>::TSAValue TSAValue;
+    typedef std::pair<const TSAValue*, const TSAValue*> THits;
+
+    size_t numHits = 0;
+    KmerRoller<TConfig::Size> roller;
+    MinimizerSampler<TConfig::Size> sampler(index.Window());
+    for (size_t i = 0; i < length(query); ++i)
+    {
+        if (!roller.Push(ordValue(query[i])))
         {
-            // Find the reference position
-            size_t refSeq = getValueI1( hits[i] );
-            size_t refPos = getValueI2( hits[i] );
-            TSeed seed = TSeed(qPos, refPos, TConfig::Size);
-            setScore(seed, score);
-            //std::cout << seed << " " << seqan::score(seed) << " " << score << std::endl;
-            
-            if (!addSeed(seeds[refSeq], seed, 0, Merge()))
-            {
-                addSeed(seeds[refSeq], seed, Single());
-            }
+            sampler.Reset();
+            continue;
         }
+
+        size_t qPos = i + 1 - TConfig::Size;
+        sampler.Push(MinimizerKey<TConfig::Size>(roller.hash), qPos,
+                [&](size_t minPos, uint64_t key) {
+                    if (skip != NULL && skip[minPos])
+                        return;
+                    THits hits = index.Occurrences(key);
+                    size_t count = hits.second - hits.first;
+                    if (count == 0)
+                        return;
+
+                    // Score by frequency, as for the q-gram seeds
+                    float frequency = float(count)/float(refSet.Size());
+                    float score = log( 1.0/frequency );
+                    AddSeedHits<TConfig>(seeds, hits.first, hits.second, minPos, score,
+                                         refSet.Length(), refSet, false);
+                    numHits += count;
+                });
     }
+    return numHits;
 }
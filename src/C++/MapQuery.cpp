@@ -0,0 +1,340 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include <seqan/index.h>
+#include <seqan/seeds.h>
+
+#include "config/SeqAnConfig.hpp"
+#include "config/Types.hpp"
+#include "parameters/SrsliParameters.hpp"
+#include "ReferenceSet.hpp"
+#include "QGramIndex.hpp"
+#include "MinimizerIndex.hpp"
+#include "AlignmentRecord.hpp"
+#include "SequenceReader.hpp"
+#include "FindSeeds.hpp"
+#include "SeedIntervals.cpp"
+#include "ScoredChaining.cpp"
+#include "SparseAlignment.cpp"
+
+using namespace seqan;
+using namespace srsli;
+
+// The seed, interval, chain and alignment buffers used while mapping, which
+//    are emptied between queries but keep their storage, so that once they
+//    have grown a worker maps each query with few allocations of its own.
+//    Each worker thread owns one, so nothing in here is ever shared
+struct QueryScratch {
+    std::vector<SeedHit> rawHits;
+    std::vector<SeedHit> sortBuffer;
+    SeedBuckets<TSeed> seedHits;
+    std::vector<SeedInterval> seedIntervals;
+    std::vector<ReferencedSeedChain> seedChains;
+    QueryKmerHashes kmerHashes;
+    std::vector<uint8_t> lowQualityKmers;
+    SeedChainScratch chainScratch;
+    ScoredChainBuffers scoredChainBuffers;
+    ChainAlignScratch alignScratch;
+    std::vector<CandidateAlignScratch> candidateScratch;
+    BandedAlignBuffers alignBuffers;
+    GapFillBatch gapFills;
+    BandedEditBuffers editBuffers;
+
+    // The queries of a batch and their candidate chains, for the batch aligner
+    std::vector<const SequenceRecord*> batchQueries;
+    std::vector<std::vector<ReferencedSeedChain>> batchChains;
+
+    // Running seeding totals for this worker, for comparing seeders
+    size_t numSeedHits;
+    size_t numSkippedKmers;
+    double seedingSeconds;
+
+    QueryScratch()
+        : numSeedHits( 0 )
+        , numSkippedKmers( 0 )
+        , seedingSeconds( 0.0 )
+    {}
+
+    // Empty every buffer before the next query
+    void Reset()
+    {
+        rawHits.clear();
+        seedHits.Clear();
+        seedIntervals.clear();
+        seedChains.clear();
+    }
+};
+
+// Find the raw seed hits for one query against the dense q-gram index, with
+//    whichever seeder was asked for ...
+template<typename TConfig>
+size_t SeedQuery(QueryScratch& scratch,
+                 const QGramIndex<TConfig>& index,
+                 const ReferenceSet& refSet,
+                 const Dna5String& query,
+                 const SrsliParameters& params,
+                 const uint8_t* skip)
+{
+    if (params.seeder == "direct")
+        return FindSeedsDirect<TConfig>(scratch.rawHits, index, refSet, query, scratch.kmerHashes, skip);
+    return FindSeeds<TConfig>(scratch.rawHits, index, refSet, query, skip);
+}
+
+// ... or against the sparse minimizer index
+template<typename TConfig>
+size_t SeedQuery(QueryScratch& scratch,
+                 const MinimizerIndex<TConfig>& index,
+                 const ReferenceSet& refSet,
+                 const Dna5String& query,
+                 const SrsliParameters&,
+                 const uint8_t* skip)
+{
+    return FindSeeds<TConfig>(scratch.rawHits, index, refSet, query, skip);
+}
+
+// Run the seed -> interval -> chain stages for one query, leaving the ranked
+//    seed chains in the scratch
+template<typename TConfig, typename TIndex>
+int ChainQuery(const std::pair<size_t, SequenceRecord>& idxAndRecord,
+               const TIndex& index,
+               const ReferenceSet& refSet,
+               const SrsliParameters& params,
+               QueryScratch& scratch)
+{
+    const SequenceRecord& record = idxAndRecord.second;
+    bool verbose = params.verbosity > 2;
+
+    if (verbose)
+        std::cerr << "Query #" << idxAndRecord.first+1
+                  << " - " << record.Id << std::endl;
+
+    scratch.Reset();
+
+    // Calculate the maximum expected interval size, given the query length
+    size_t maxIntervalLength = length(record.Seq) * params.maxNetIndelRate;
+
+    // Find the Kmer matches for the current query sequence, leaving out any
+    //    in stretches of low base quality when asked to
+    auto seedingStart = std::chrono::steady_clock::now();
+    const uint8_t* skip = NULL;
+    if (params.minQuality > 0)
+    {
+        scratch.numSkippedKmers += MaskLowQualityKmers(scratch.lowQualityKmers, record.Seq, record.Qual,
+                                                       TConfig::Size, params.minQuality,
+                                                       params.qualityWindow);
+        skip = scratch.lowQualityKmers.data();
+    }
+    scratch.numSeedHits += SeedQuery<TConfig>(scratch, index, refSet, record.Seq, params, skip);
+    scratch.seedingSeconds += std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - seedingStart).count();
+
+    // Merge the Kmer matches into seeds and sort them by reference position
+    SeedHitsToSeedBuckets(scratch.rawHits, scratch.sortBuffer, scratch.seedHits);
+
+    // Chain the seeds with the gap-scored chainer, or within each seed interval
+    if (params.chainer == "scored")
+    {
+        ScoredSeedChains(scratch.seedChains,
+                         scratch.seedHits,
+                         maxIntervalLength,
+                         ChainScoring(params.chainGapCost,
+                                      params.chainIndelCost,
+                                      params.chainLookback),
+                         scratch.scoredChainBuffers);
+    } else {
+        GetSeedIntervals(scratch.seedIntervals, scratch.seedHits, maxIntervalLength);
+
+        if (params.chainer == "seqan")
+            SeedIntervalsToSeedChains(scratch.seedChains,
+                                      scratch.seedHits,
+                                      scratch.seedIntervals,
+                                      scratch.chainScratch);
+        else
+            SlideSeedIntervalsToSeedChains(scratch.seedChains,
+                                           scratch.seedHits,
+                                           scratch.seedIntervals,
+                                           maxIntervalLength,
+                                           scratch.chainScratch);
+    }
+
+    if (verbose)
+        std::cerr << "Found " << scratch.seedIntervals.size() << " seed intervals and "
+                  << scratch.seedChains.size() << " seed chains" << std::endl;
+
+    // If we made it this far, return 0 for successful completion
+    return 0;
+}
+
+// How far past the ends of a chain to take sequence for its alignment: the
+//    SIMD aligners extend until the X-drop stops them, so they get room for
+//    that, while SeqAn aligns the whole region and gets a short fixed buffer
+int AlignmentBuffer(const SrsliParameters& params)
+{
+    return (params.aligner == "seqan") ? params.maxChainBuffer : params.maxExtension;
+}
+
+// The SIMD aligners' scoring and banding
+BandedAlignParams ToBandedAlignParams(const Score<long, Simple>& scoring,
+                                      const SrsliParameters& params)
+{
+    BandedAlignParams alignParams = { (int)scoreMatch(scoring),
+                                      (int)scoreMismatch(scoring),
+                                      (int)scoreGapExtend(scoring),
+                                      (size_t)params.alignBandWidth,
+                                      (size_t)params.alignMinBandWidth,
+                                      BandedAlignGlobal,
+                                      params.xDrop };
+    return alignParams;
+}
+
+// Align long queries in blocks, spread over the workers when there are others
+IntraReadParallel ToIntraReadParallel(ThreadPool* pool,
+                                      const SrsliParameters& params)
+{
+    IntraReadParallel parallel = { (pool != NULL && pool->Size() > 1) ? pool : NULL,
+                                   (size_t)params.parallelReadLength,
+                                   (size_t)params.parallelBlockLength };
+    return parallel;
+}
+
+// Rate how uniquely one query mapped, from the spread between its best and
+//    second best alignment scores: the best alignment is the primary one,
+//    with a quality of 60 when nothing else scores near it, falling to 0 as
+//    the runner-up's score approaches its own, and the rest are secondary
+void AssignMappingQualities(std::vector<AlignmentRecord>& results,
+                            const size_t begin,
+                            const size_t end)
+{
+    if (begin == end)
+        return;
+
+    size_t best = begin;
+    for (size_t i = begin + 1; i < end; ++i)
+        if (results[i].Score > results[best].Score)
+            best = i;
+    long secondScore = 0;
+    for (size_t i = begin; i < end; ++i)
+        if (i != best)
+            secondScore = std::max(secondScore, results[i].Score);
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        results[i].IsSecondary = (i != best);
+        results[i].MappingQuality = 0;
+    }
+    long bestScore = results[best].Score;
+    if (bestScore > 0)
+        results[best].MappingQuality = std::min(60L, std::max(0L, 60 * (bestScore - secondScore) / bestScore));
+}
+
+// Run the full seed -> interval -> chain -> alignment pipeline for one query,
+//    appending any accepted alignments to the results.  Long queries also
+//    align on the pool's other workers, when given it
+template<typename TConfig, typename TIndex>
+int MapQuery(std::vector<AlignmentRecord>& results,
+             const std::pair<size_t, SequenceRecord>& idxAndRecord,
+             const TIndex& index,
+             const ReferenceSet& refSet,
+             const SrsliParameters& params,
+             const Score<long, Simple>& scoring,
+             QueryScratch& scratch,
+             ThreadPool* pool = NULL)
+{
+    const SequenceRecord& record = idxAndRecord.second;
+    ChainQuery<TConfig>(idxAndRecord, index, refSet, params, scratch);
+
+    int maxAligns = std::min((int)scratch.seedChains.size(), params.nCandidates);
+    size_t firstResult = results.size();
+
+    // Chain the initial Kmer hits into an alignment
+    RefChainsToAlignments(results,
+                          record.Seq,
+                          refSet,
+                          scratch.seedChains,
+                          scoring,
+                          maxAligns,
+                          params.minAccuracy,
+                          AlignmentBuffer(params),
+                          params.maxNetIndelRate,
+                          params.alignmentAnchor,
+                          params.aligner,
+                          ToBandedAlignParams(scoring, params),
+                          params.prefilter,
+                          scratch.alignBuffers,
+                          scratch.editBuffers,
+                          scratch.alignScratch,
+                          ToIntraReadParallel(pool, params),
+                          scratch.candidateScratch);
+
+    for (size_t i = firstResult; i < results.size(); ++i)
+        results[i].Query = &record;
+    AssignMappingQualities(results, firstResult, results.size());
+
+    // If we made it this far, return 0 for successful completion
+    return 0;
+}
+
+// Map a batch of queries.  The batch aligner chains every query first and
+//    then aligns all of their candidates together; the others go one query
+//    at a time
+template<typename TConfig, typename TIndex>
+int MapQueryBatch(std::vector<AlignmentRecord>& results,
+                  const std::vector<std::pair<size_t, SequenceRecord>>& batch,
+                  const TIndex& index,
+                  const ReferenceSet& refSet,
+                  const SrsliParameters& params,
+                  const Score<long, Simple>& scoring,
+                  QueryScratch& scratch,
+                  ThreadPool* pool = NULL)
+{
+    if (params.aligner != "batch")
+    {
+        for (size_t i = 0; i < batch.size(); ++i)
+            MapQuery<TConfig>(results, batch[i], index, refSet, params, scoring, scratch, pool);
+        return 0;
+    }
+
+    std::vector<const SequenceRecord*>& queries = scratch.batchQueries;
+    std::vector<std::vector<ReferencedSeedChain>>& chains = scratch.batchChains;
+    queries.resize(batch.size());
+    chains.resize(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        ChainQuery<TConfig>(batch[i], index, refSet, params, scratch);
+        size_t maxAligns = std::min(scratch.seedChains.size(), (size_t)params.nCandidates);
+        queries[i] = &batch[i].second;
+
+        // Take the query's chains over rather than copying them, handing the
+        //    scratch the previous batch's list to reuse
+        chains[i].swap(scratch.seedChains);
+        chains[i].resize(maxAligns);
+    }
+
+    size_t firstResult = results.size();
+    BatchRefChainsToAlignments(results,
+                               queries,
+                               refSet,
+                               chains,
+                               params.minAccuracy,
+                               AlignmentBuffer(params),
+                               params.maxNetIndelRate,
+                               ToBandedAlignParams(scoring, params),
+                               params.batchGapFillLength,
+                               params.prefilter,
+                               scratch.gapFills,
+                               scratch.editBuffers,
+                               scratch.alignScratch);
+
+    // Each query's alignments come out together, in query order
+    for (size_t begin = firstResult, end; begin < results.size(); begin = end)
+    {
+        for (end = begin + 1; end < results.size() && results[end].Query == results[begin].Query; ++end) {}
+        AssignMappingQualities(results, begin, end);
+    }
+
+    // If we made it this far, return 0 for successful completion
+    return 0;
+}
@@ -0,0 +1,99 @@
+// Author: Brett Bowman
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <utility>
+
+#include "MappedFile.hpp"
+
+namespace srsli {
+
+    const char* MappedFile::Data() const
+    {
+        return static_cast<const char*>(data);
+    }
+
+    size_t MappedFile::Size() const
+    {
+        return size;
+    }
+
+    bool MappedFile::IsOpen() const
+    {
+        return data != nullptr;
+    }
+
+    void MappedFile::Close()
+    {
+        if (data != nullptr)
+            munmap(data, size);
+        data = nullptr;
+        size = 0;
+    }
+
+    // Constructors
+    MappedFile::MappedFile()
+            : data( nullptr )
+            , size( 0 )
+    {}
+
+    MappedFile::MappedFile(const std::string& filename_)
+            : filename( filename_ )
+            , data( nullptr )
+            , size( 0 )
+    {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("ERROR: Could not open " + filename);
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+        {
+            close(fd);
+            throw std::runtime_error("ERROR: Could not read " + filename);
+        }
+        size = fileStat.st_size;
+
+        // The mapping stays valid after the descriptor is closed
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            size = 0;
+            throw std::runtime_error("ERROR: Could not map " + filename);
+        }
+        data = mapping;
+    }
+
+    MappedFile::~MappedFile()
+    {
+        Close();
+    }
+
+    MappedFile::MappedFile(MappedFile&& other)
+            : filename( std::move(other.filename) )
+            , data( other.data )
+            , size( other.size )
+    {
+        other.data = nullptr;
+        other.size = 0;
+    }
+
+    MappedFile& MappedFile::operator=(MappedFile&& other)
+    {
+        if (this != &other)
+        {
+            Close();
+            filename = std::move(other.filename);
+            data = other.data;
+            size = other.size;
+            other.data = nullptr;
+            other.size = 0;
+        }
+        return *this;
+    }
+}
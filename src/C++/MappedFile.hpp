@@ -0,0 +1,33 @@
+// Author: Brett Bowman
+
+#pragma once
+
+#include <string>
+
+namespace srsli {
+
+    /// A read-only memory mapping of an entire file
+    class MappedFile {
+
+    private:
+        std::string filename;
+        void* data;
+        size_t size;
+
+    public:
+        const char* Data() const;
+        size_t Size() const;
+        bool IsOpen() const;
+        void Close();
+
+    public:
+        MappedFile();
+        MappedFile(const std::string& filename_);
+        ~MappedFile();
+
+        MappedFile(MappedFile&& other);
+        MappedFile& operator=(MappedFile&& other);
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+    };
+}
@@ -0,0 +1,68 @@
+// Author: Brett Bowman
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "config/SeqAnConfig.hpp"
+#include "ReferenceSet.hpp"
+#include "QGramIndex.hpp"
+
+namespace srsli {
+
+    /// A sparse index of the (w,k) minimizers of every reference record, on
+    ///   both strands.  Only the sampled positions are stored, as hits sorted
+    ///   by minimizer key, with a directory over the top bits of the key to
+    ///   narrow each lookup down to a short binary search
+    template<typename TConfig = FindSeedsConfig<>>
+    class MinimizerIndex {
+
+    public:
+        typedef QGramHit TSAValue;
+
+    private:
+        std::vector<uint32_t> keys;
+        std::vector<TSAValue> hits;
+        std::vector<uint64_t> dir;
+        size_t dirShift;
+        size_t window;
+        size_t maskedKeys;
+
+    public:
+        // Sample and index the reference, skipping any minimizer that occurs
+        //    more than maxOccurrences times (0 for no limit)
+        void Build(const ReferenceSet& refSet,
+                   const size_t window_,
+                   const uint64_t maxOccurrences = 0);
+
+        // The hits for one minimizer key
+        inline std::pair<const TSAValue*, const TSAValue*> Occurrences(const uint64_t key) const
+        {
+            size_t bucket = key >> dirShift;
+            const uint32_t* first = keys.data() + dir[bucket];
+            const uint32_t* last  = keys.data() + dir[bucket+1];
+            std::pair<const uint32_t*, const uint32_t*> range =
+                    std::equal_range(first, last, (uint32_t)key);
+            return std::make_pair(hits.data() + (range.first  - keys.data()),
+                                  hits.data() + (range.second - keys.data()));
+        }
+
+        size_t Window() const { return window; }
+        size_t Length() const { return hits.size(); }
+        size_t MaskedKeys() const { return maskedKeys; }
+        size_t MemoryUsage() const
+        {
+            return keys.size() * sizeof(uint32_t) +
+                   hits.size() * sizeof(TSAValue) +
+                   dir.size()  * sizeof(uint64_t);
+        }
+
+    public:
+        MinimizerIndex();
+    };
+}
+
+#include "MinimizerIndexImpl.hpp"
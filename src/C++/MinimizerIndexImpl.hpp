@@ -0,0 +1,99 @@
+// Author: Brett Bowman
+
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "utils/Kmer.cpp"
+#include "utils/RadixSort.cpp"
+
+namespace srsli {
+
+    // A sampled minimizer while the index is being built
+    struct MinimizerEntry {
+        uint32_t key;
+        QGramHit hit;
+    };
+
+    template<typename TConfig>
+    MinimizerIndex<TConfig>::MinimizerIndex()
+            : dirShift( 0 )
+            , window( 0 )
+            , maskedKeys( 0 )
+    {}
+
+    template<typename TConfig>
+    void MinimizerIndex<TConfig>::Build(const ReferenceSet& refSet,
+                                        const size_t window_,
+                                        const uint64_t maxOccurrences)
+    {
+        static_assert(TConfig::Size <= 16, "MinimizerIndex stores 32-bit keys");
+        if (window_ == 0)
+            throw std::runtime_error("ERROR: The minimizer window must be at least 1");
+        window = window_;
+
+        for (size_t i = 0; i < refSet.Records.size(); ++i)
+            if (refSet.Records[i].seq.Length() > UINT32_MAX)
+                throw std::runtime_error("ERROR: Reference sequences over 4Gbp can't be indexed");
+
+        // Sample every record on both strands, restarting the windows after
+        //    each N and at the start of each record
+        std::vector<MinimizerEntry> entries;
+        MinimizerSampler<TConfig::Size> sampler(window);
+        size_t lastRec = SIZE_MAX, lastPos = 0;
+        ForEachReferenceKmer<TConfig::Size>(refSet, refSet.Records.size(),
+                [&](size_t recIdx, size_t pos, uint64_t hash) {
+                    if (recIdx != lastRec || pos != lastPos + 1)
+                        sampler.Reset();
+                    lastRec = recIdx;
+                    lastPos = pos;
+                    sampler.Push(MinimizerKey<TConfig::Size>(hash), pos,
+                            [&](size_t minPos, uint64_t key) {
+                                MinimizerEntry e = { (uint32_t)key, QGramHit(recIdx, minPos) };
+                                entries.push_back(e);
+                            });
+                });
+
+        // Entries arrive in reference order, so a stable sort by key leaves
+        //    each key's hits position-sorted like the q-gram buckets
+        std::vector<MinimizerEntry> buffer;
+        RadixSortByKey(entries, buffer, [](const MinimizerEntry& e) { return uint64_t(e.key); });
+        buffer = std::vector<MinimizerEntry>();
+
+        // Split off the keys and hits, dropping any key with too many hits
+        keys.clear();
+        hits.clear();
+        maskedKeys = 0;
+        for (size_t i = 0, j; i < entries.size(); i = j)
+        {
+            for (j = i + 1; j < entries.size() && entries[j].key == entries[i].key; ++j) {}
+            if (maxOccurrences > 0 && j - i > maxOccurrences)
+            {
+                ++maskedKeys;
+                continue;
+            }
+            for (size_t e = i; e < j; ++e)
+            {
+                keys.push_back(entries[e].key);
+                hits.push_back(entries[e].hit);
+            }
+        }
+        keys.shrink_to_fit();
+        hits.shrink_to_fit();
+
+        // Size the directory to roughly one bucket per four hits
+        const size_t keyBits = 2 * TConfig::Size;
+        size_t dirBits = 1;
+        while (dirBits < keyBits && (size_t(1) << (dirBits + 2)) < hits.size())
+            ++dirBits;
+        dirShift = keyBits - dirBits;
+
+        const size_t numBuckets = size_t(1) << dirBits;
+        dir.assign(numBuckets + 1, 0);
+        for (size_t i = 0; i < keys.size(); ++i)
+            ++dir[(keys[i] >> dirShift) + 1];
+        for (size_t b = 0; b < numBuckets; ++b)
+            dir[b+1] += dir[b];
+    }
+}
@@ -0,0 +1,146 @@
+// Author: Brett Bowman
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "config/SeqAnConfig.hpp"
+#include "config/SeedSizeDispatch.hpp"
+#include "ReferenceSet.hpp"
+#include "MappedFile.hpp"
+
+namespace srsli {
+
+    // Number of power-of-two bins in the q-gram frequency histogram
+    const size_t QGramHistogramBins = 32;
+
+    // How the q-grams of an index were masked at build time.  Occurrences
+    //    count both strands, like the cutoffs, and bin b of the histogram
+    //    counts the q-grams seen [2^b, 2^(b+1)) times, before masking
+    struct QGramMaskStats {
+        uint64_t maxOccurrences;
+        uint64_t distinctQGrams;
+        uint64_t totalOccurrences;
+        uint64_t maskedQGrams;
+        uint64_t maskedOccurrences;
+        uint64_t histogram[QGramHistogramBins];
+    };
+
+    // Fixed-size header at the start of every saved index file.  The
+    //    directory and suffix array follow it at the recorded offsets
+    struct QGramIndexHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t seedSize;
+        uint32_t alphabetSize;
+        uint32_t dirValueSize;
+        uint32_t saValueSize;
+        uint32_t flags;
+        uint64_t referenceCount;
+        uint64_t referenceSize;
+        uint64_t referenceFingerprint;
+        uint64_t dirLength;
+        uint64_t saLength;
+        uint64_t dirOffset;
+        uint64_t saOffset;
+        QGramMaskStats maskStats;
+    };
+
+    const char QGramIndexMagic[8] = { 'S', 'R', 'S', 'L', 'I', 'Q', 'G', 'I' };
+    const uint32_t QGramIndexVersion = 3;
+
+    // Header flag for indices holding only the forward strand of each record
+    const uint32_t QGramIndexForwardOnly = 0x1;
+
+    // One occurrence of a q-gram: the ReferenceRecord and position it starts at
+    struct QGramHit {
+        uint32_t seq;
+        uint32_t pos;
+
+        QGramHit() {}
+
+        QGramHit(uint32_t s, uint32_t p)
+            : seq( s )
+            , pos( p )
+        {}
+    };
+
+    /// The q-gram directory and suffix array for a ReferenceSet, either built
+    ///   in memory from its packed sequences or mapped read-only from a file
+    ///   written by Save().  Forward-only indices skip the reverse records,
+    ///   and are searched with both orientations of each query q-gram instead.
+    ///   Q-grams occurring more than a cutoff number of times on both strands
+    ///   combined are masked, leaving their buckets empty
+    template<typename TConfig = FindSeedsConfig<>>
+    class QGramIndex {
+
+    public:
+        typedef uint64_t TDirValue;
+        typedef QGramHit TSAValue;
+
+    private:
+        // Exactly one of these owns the memory the pointers below refer to
+        std::vector<TDirValue> dirStore;
+        std::vector<TSAValue> saStore;
+        MappedFile mapped;
+
+        const TDirValue* dir;
+        const TSAValue* sa;
+        size_t dirLength;
+        size_t saLength;
+        bool forwardOnly;
+        QGramMaskStats maskStats;
+
+    private:
+        uint64_t BothStrandCount(const size_t hash) const;
+        QGramIndexHeader MakeHeader(const ReferenceSet& refSet) const;
+        void CheckHeader(const QGramIndexHeader& header,
+                         const ReferenceSet& refSet) const;
+
+    public:
+        // Build the index for the reference in memory, masking the q-grams that
+        //    occur more than maxOccurrences times, or are among the maskFraction
+        //    most frequent.  Zero disables either cutoff
+        void Build(const ReferenceSet& refSet,
+                   const bool forwardOnly_ = false,
+                   const uint64_t maxOccurrences = 0,
+                   const double maskFraction = 0.0);
+
+        // Map a saved index, rejecting it if it doesn't match the reference
+        void Open(const std::string& filename, const ReferenceSet& refSet);
+
+        // Write the index and the reference's metadata to a file
+        void Save(const std::string& filename, const ReferenceSet& refSet) const;
+
+        // The suffix array entries for one q-gram hash value
+        inline std::pair<const TSAValue*, const TSAValue*> Occurrences(const size_t hash) const
+        {
+            return std::make_pair(sa + dir[hash], sa + dir[hash+1]);
+        }
+
+        // Hint that a bucket's directory entry, or the hits it points to, will
+        //    be read soon.  The latter reads the directory entry itself
+        inline void PrefetchBucket(const size_t hash) const
+        {
+            __builtin_prefetch(dir + hash);
+        }
+
+        inline void PrefetchOccurrences(const size_t hash) const
+        {
+            __builtin_prefetch(sa + dir[hash]);
+        }
+
+        size_t DirLength() const { return dirLength; }
+        size_t SALength() const { return saLength; }
+        bool ForwardOnly() const { return forwardOnly; }
+        const QGramMaskStats& MaskStats() const { return maskStats; }
+
+    public:
+        QGramIndex();
+    };
+}
+
+#include "QGramIndexImpl.hpp"
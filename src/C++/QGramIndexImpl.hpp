@@ -0,0 +1,289 @@
+// Author: Brett Bowman
+
+#pragma once
+
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include <seqan/sequence.h>
+
+#include "utils/Kmer.cpp"
+
+using namespace seqan;
+
+namespace srsli {
+
+    // Sections of the index file start on cache-line boundaries
+    inline uint64_t AlignIndexOffset(const uint64_t offset)
+    {
+        return (offset + 63) & ~uint64_t(63);
+    }
+
+    template<typename TConfig>
+    QGramIndex<TConfig>::QGramIndex()
+            : dir( nullptr )
+            , sa( nullptr )
+            , dirLength( 0 )
+            , saLength( 0 )
+            , forwardOnly( false )
+    {
+        memset(&maskStats, 0, sizeof(maskStats));
+    }
+
+    // Call f(recordIdx, position, hash) for every N-free k-mer in the first
+    //    numRecords reference records, unpacking each through its view in chunks
+    template<size_t K, typename TFunctor>
+    void ForEachReferenceKmer(const ReferenceSet& refSet,
+                              const size_t numRecords,
+                              TFunctor f)
+    {
+        const size_t chunkSize = 1 << 20;
+        std::vector<uint8_t> chunk(chunkSize);
+
+        for (size_t recIdx = 0; recIdx < numRecords; ++recIdx)
+        {
+            const ReferenceView& view = refSet.Records[recIdx].seq;
+            KmerRoller<K> roller;
+            for (size_t start = 0; start < view.Length(); start += chunkSize)
+            {
+                size_t end = std::min(start + chunkSize, view.Length());
+                view.CopyOrdValues(chunk.data(), start, end);
+                for (size_t i = start; i < end; ++i)
+                {
+                    if (roller.Push(chunk[i - start]))
+                        f(recIdx, i + 1 - K, roller.hash);
+                }
+            }
+        }
+    }
+
+    template<typename TConfig>
+    void QGramIndex<TConfig>::Build(const ReferenceSet& refSet,
+                                    const bool forwardOnly_,
+                                    const uint64_t maxOccurrences,
+                                    const double maskFraction)
+    {
+        if (TConfig::Size > MaxQGramSeedSize)
+            throw std::runtime_error("ERROR: Seed sizes over " + std::to_string(MaxQGramSeedSize) +
+                                     " need a minimizer index, built with --window");
+        const size_t numBuckets = size_t(1) << (2 * TConfig::Size);
+
+        // The forward records come first, followed by their reverse strands
+        forwardOnly = forwardOnly_;
+        size_t numRecords = forwardOnly ? refSet.Length() : refSet.Records.size();
+
+        for (size_t i = 0; i < refSet.Records.size(); ++i)
+            if (refSet.Records[i].seq.Length() > UINT32_MAX)
+                throw std::runtime_error("ERROR: Reference sequences over 4Gbp can't be indexed");
+
+        mapped.Close();
+        dirStore.assign(numBuckets + 1, 0);
+
+        // Count the occurrences of each q-gram ...
+        ForEachReferenceKmer<TConfig::Size>(refSet, numRecords,
+                [&](size_t, size_t, uint64_t hash) { ++dirStore[hash]; });
+
+        // ... tally how often each q-gram occurs, for reporting and for the
+        //    fraction cutoff ...
+        memset(&maskStats, 0, sizeof(maskStats));
+        std::vector<uint32_t> frequencies;
+        for (size_t h = 0; h < numBuckets; ++h)
+        {
+            uint64_t count = BothStrandCount(h);
+            if (count == 0)
+                continue;
+            ++maskStats.distinctQGrams;
+            maskStats.totalOccurrences += count;
+            size_t bin = std::min<size_t>(63 - __builtin_clzll(count), QGramHistogramBins - 1);
+            ++maskStats.histogram[bin];
+            if (maskFraction > 0.0)
+                frequencies.push_back(std::min<uint64_t>(count, UINT32_MAX));
+        }
+
+        // ... pick the tighter of the two cutoffs, the fraction's being the
+        //    highest frequency among the q-grams it keeps, so that ties with
+        //    a kept q-gram are kept too ...
+        bool limited = (maxOccurrences > 0);
+        uint64_t cutoff = maxOccurrences;
+        size_t numKept = size_t((1.0 - maskFraction) * frequencies.size());
+        if (numKept < frequencies.size())
+        {
+            std::nth_element(frequencies.begin(), frequencies.begin() + numKept, frequencies.end());
+            uint64_t fractionCutoff = (numKept == 0) ? 0 :
+                    *std::max_element(frequencies.begin(), frequencies.begin() + numKept);
+            cutoff = limited ? std::min(cutoff, fractionCutoff) : fractionCutoff;
+            limited = true;
+        }
+        maskStats.maxOccurrences = cutoff;
+
+        // ... mask everything above it, deciding before emptying any bucket
+        //    since a forward-only count also reads the reverse complement's ...
+        std::vector<bool> masked;
+        if (limited)
+        {
+            masked.assign(numBuckets, false);
+            for (size_t h = 0; h < numBuckets; ++h)
+            {
+                if (BothStrandCount(h) <= cutoff)
+                    continue;
+                masked[h] = true;
+                ++maskStats.maskedQGrams;
+                maskStats.maskedOccurrences += BothStrandCount(h);
+            }
+            for (size_t h = 0; h < numBuckets; ++h)
+                if (masked[h])
+                    dirStore[h] = 0;
+        }
+
+        // ... turn the counts into the start of each bucket ...
+        TDirValue total = 0;
+        for (size_t h = 0; h < numBuckets; ++h)
+        {
+            TDirValue count = dirStore[h];
+            dirStore[h] = total;
+            total += count;
+        }
+        dirStore[numBuckets] = total;
+
+        // ... then fill the buckets, using each start as a write cursor.  Since we
+        //    walk the reference in order, every bucket ends up position-sorted
+        saStore.resize(total);
+        ForEachReferenceKmer<TConfig::Size>(refSet, numRecords,
+                [&](size_t recIdx, size_t pos, uint64_t hash) {
+                    if (!masked.empty() && masked[hash])
+                        return;
+                    saStore[dirStore[hash]++] = QGramHit(recIdx, pos);
+                });
+
+        // Each cursor now points at the start of the next bucket, so shift back
+        for (size_t h = numBuckets - 1; h > 0; --h)
+            dirStore[h] = dirStore[h-1];
+        dirStore[0] = 0;
+
+        dir       = dirStore.data();
+        dirLength = dirStore.size();
+        sa        = saStore.data();
+        saLength  = saStore.size();
+    }
+
+    template<typename TConfig>
+    void QGramIndex<TConfig>::Open(const std::string& filename,
+                                   const ReferenceSet& refSet)
+    {
+        dirStore = std::vector<TDirValue>();
+        saStore = std::vector<TSAValue>();
+        mapped = MappedFile(filename);
+        if (mapped.Size() < sizeof(QGramIndexHeader))
+            throw std::runtime_error("ERROR: " + filename + " is not a srsli index");
+
+        QGramIndexHeader header;
+        memcpy(&header, mapped.Data(), sizeof(header));
+        if (memcmp(header.magic, QGramIndexMagic, sizeof(QGramIndexMagic)) != 0)
+            throw std::runtime_error("ERROR: " + filename + " is not a srsli index");
+        CheckHeader(header, refSet);
+
+        // Lookups index the directory by hash, so it must hold every bucket
+        if (header.dirLength != (uint64_t(1) << (2 * TConfig::Size)) + 1)
+            throw std::runtime_error("ERROR: " + filename + " is corrupt");
+
+        // Make sure both sections are actually present before pointing at them,
+        //    comparing lengths against the room left so nothing can overflow
+        if (header.dirOffset > mapped.Size() ||
+            header.dirLength > (mapped.Size() - header.dirOffset) / sizeof(TDirValue) ||
+            header.saOffset > mapped.Size() ||
+            header.saLength > (mapped.Size() - header.saOffset) / sizeof(TSAValue))
+            throw std::runtime_error("ERROR: " + filename + " is truncated");
+
+        dir       = reinterpret_cast<const TDirValue*>(mapped.Data() + header.dirOffset);
+        dirLength = header.dirLength;
+        sa        = reinterpret_cast<const TSAValue*>(mapped.Data() + header.saOffset);
+        saLength  = header.saLength;
+        forwardOnly = (header.flags & QGramIndexForwardOnly) != 0;
+        maskStats = header.maskStats;
+
+        if (dirLength == 0 || dir[dirLength-1] != saLength)
+            throw std::runtime_error("ERROR: " + filename + " is corrupt");
+    }
+
+    template<typename TConfig>
+    void QGramIndex<TConfig>::Save(const std::string& filename,
+                                   const ReferenceSet& refSet) const
+    {
+        QGramIndexHeader header = MakeHeader(refSet);
+
+        std::ofstream out(filename.c_str(), std::ios::binary | std::ios::out | std::ios::trunc);
+        if (!out)
+            throw std::runtime_error("ERROR: Could not open " + filename + " for writing");
+
+        const char padding[64] = { 0 };
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(padding, header.dirOffset - sizeof(header));
+        out.write(reinterpret_cast<const char*>(dir), dirLength * sizeof(TDirValue));
+        out.write(padding, header.saOffset - (header.dirOffset + dirLength * sizeof(TDirValue)));
+        out.write(reinterpret_cast<const char*>(sa), saLength * sizeof(TSAValue));
+
+        if (!out)
+            throw std::runtime_error("ERROR: Could not write " + filename);
+    }
+
+    // Private functions
+    template<typename TConfig>
+    QGramIndexHeader QGramIndex<TConfig>::MakeHeader(const ReferenceSet& refSet) const
+    {
+        QGramIndexHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, QGramIndexMagic, sizeof(QGramIndexMagic));
+        header.version              = QGramIndexVersion;
+        header.seedSize             = TConfig::Size;
+        header.alphabetSize         = ValueSize<Dna>::VALUE;
+        header.dirValueSize         = sizeof(TDirValue);
+        header.saValueSize          = sizeof(TSAValue);
+        header.flags                = forwardOnly ? QGramIndexForwardOnly : 0;
+        header.referenceCount       = refSet.Length();
+        header.referenceSize        = refSet.Size();
+        header.referenceFingerprint = refSet.Fingerprint();
+        header.dirLength            = dirLength;
+        header.saLength             = saLength;
+        header.dirOffset            = AlignIndexOffset(sizeof(header));
+        header.saOffset             = AlignIndexOffset(header.dirOffset + dirLength * sizeof(TDirValue));
+        header.maskStats            = maskStats;
+        return header;
+    }
+
+    // Occurrences of a q-gram on both strands of the reference, from the
+    //    per-bucket counts Build() keeps in the directory before the prefix sum
+    template<typename TConfig>
+    uint64_t QGramIndex<TConfig>::BothStrandCount(const size_t hash) const
+    {
+        if (!forwardOnly)
+            return dirStore[hash];
+        return dirStore[hash] + dirStore[ReverseComplementHash<TConfig::Size>(hash)];
+    }
+
+    template<typename TConfig>
+    void QGramIndex<TConfig>::CheckHeader(const QGramIndexHeader& header,
+                                          const ReferenceSet& refSet) const
+    {
+        if (header.version != QGramIndexVersion)
+            throw std::runtime_error("ERROR: Index was written by an incompatible version of srsli");
+
+        if (header.seedSize != (uint32_t)TConfig::Size)
+            throw std::runtime_error("ERROR: Index was built with seed size " +
+                                     std::to_string(header.seedSize) + ", not " +
+                                     std::to_string(TConfig::Size));
+
+        if (header.alphabetSize != ValueSize<Dna>::VALUE ||
+            header.dirValueSize != sizeof(TDirValue) ||
+            header.saValueSize  != sizeof(TSAValue))
+            throw std::runtime_error("ERROR: Index layout does not match this build of srsli");
+
+        if (header.referenceCount       != refSet.Length() ||
+            header.referenceSize        != refSet.Size()   ||
+            header.referenceFingerprint != refSet.Fingerprint())
+            throw std::runtime_error("ERROR: Index is stale, it was built from a different reference");
+    }
+}
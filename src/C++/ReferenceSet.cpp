@@ -15,6 +15,43 @@ using namespace seqan;
 
 namespace srsli {
 
+    // 64-bit FNV-1a hash over every id and base, with each record terminated
+    //    so that moving bases between records changes the result
+    static const uint64_t FingerprintPrime = 1099511628211ULL;
+    static const uint64_t FingerprintBasis = 14695981039346656037ULL;
+
+    static uint64_t FingerprintRecord(uint64_t hash,
+                                      const CharString& id,
+                                      const TDna& seq)
+    {
+        for (size_t j = 0; j < length(id); ++j)
+            hash = (hash ^ (uint8_t)id[j]) * FingerprintPrime;
+        hash = (hash ^ 0xFF) * FingerprintPrime;
+        for (size_t j = 0; j < length(seq); ++j)
+            hash = (hash ^ ordValue(seq[j])) * FingerprintPrime;
+        return (hash ^ 0xFF) * FingerprintPrime;
+    }
+
+    // Store a sequence at 2 bits per base, recording its Ns as runs instead
+    static void PackSequence(TPackedDna& packed,
+                             std::vector<NRun>& runs,
+                             const TDna& seq)
+    {
+        resize(packed, length(seq), Exact());
+        for (size_t i = 0; i < length(seq); ++i)
+        {
+            if (ordValue(seq[i]) == NOrdValue)
+            {
+                if (!runs.empty() && runs.back().end == i)
+                    ++runs.back().end;
+                else
+                    runs.push_back(NRun(i, i+1));
+            }
+            // Dna5 -> Dna keeps the low 2 bits, so masked Ns are stored as A
+            packed[i] = Dna(seq[i]);
+        }
+    }
+
     size_t ReferenceSet::Size() const
     {
         return size;
@@ -25,17 +62,22 @@ namespace srsli {
         return seqCount;
     }
 
-    StringSet<CharString> ReferenceSet::Ids() const
+    uint64_t ReferenceSet::Fingerprint() const
+    {
+        return fingerprint;
+    }
+
+    const StringSet<CharString>& ReferenceSet::Ids() const
     {
         return ids;
     }
 
-    StringSet<TDna> ReferenceSet::Sequences() const
+    const StringSet<TPackedDna>& ReferenceSet::Sequences() const
     {
         return seqs;
     }
 
-    FaiIndex ReferenceSet::FaiIndex() const
+    const seqan::FaiIndex& ReferenceSet::FaiIndex() const
     {
         return faiIndex;
     }
@@ -45,8 +87,8 @@ namespace srsli {
             : filename( filename_ )
             , faiFilename( filename + ".fai" )
     {
-        std::cout << "file: " << filename    << std::endl;
-        std::cout << "fai: "  << faiFilename << std::endl;
+        std::cerr << "file: " << filename    << std::endl;
+        std::cerr << "fai: "  << faiFilename << std::endl;
 
         // Build an FAI index if one doesn't exist
         //int res = build(faiIndex, filename.c_str(), faiFilename.c_str());
@@ -57,38 +99,40 @@ namespace srsli {
         std::fstream in(filename.c_str(), std::ios::binary | std::ios::in);
         RecordReader<std::fstream, SinglePass<>> reader(in);
 
-        // Iterate over the records in the file
-        if (read2(ids, seqs, reader, seqan::Fasta()) != 0)
-            throw std::runtime_error("Invalid Fasta file");
+        // Read and pack one record at a time, so only a single contig is
+        //    ever held at a full byte per base
+        CharString id;
+        TDna seq;
+        size = 0;
+        fingerprint = FingerprintBasis;
+        while (!atEnd(reader))
+        {
+            if (readRecord(id, seq, reader, seqan::Fasta()) != 0)
+                throw std::runtime_error("Invalid Fasta file");
+
+            fingerprint = FingerprintRecord(fingerprint, id, seq);
+            appendValue(ids, id);
+            resize(seqs, length(seqs) + 1);
+            nRuns.push_back(std::vector<NRun>());
+            PackSequence(back(seqs), nRuns.back(), seq);
+            size += 2*length(seq);  // 2x for Forward + RC
+        }
 
         // Set seqCount the current (non-RC'd) number of sequences
         seqCount = length(seqs);
 
-        // Iterate over the StringSet, adding the RC sequences and sum-ing the lengths
-        size = 0;
-        resize(seqs, 2*seqCount, Exact());
+        // Build a ReferenceRecord for each strand of each sequence, with the
+        //    reverse records reading the forward bases through an RC view
+        Records.resize(2*seqCount);
         for (size_t i = 0; i < seqCount; ++i)
         {
-            TDna rcSeq = seqs[i];
-            reverseComplement(rcSeq);
-            seqs[i+seqCount] = rcSeq;
-            size += 2*length(rcSeq);  // 2x for Forward + RC
-        }
+            Records[i].id = ids[i];
+            Records[i].seq = ReferenceView(&seqs[i], &nRuns[i], false);
+            Records[i].orientation = 0;
 
-        // Iterate over the sequences, building a ReferenceRecord struct for each
-        Records.resize(2*seqCount);
-        for (size_t i = 0; i < length(seqs); ++i)
-        {
-            if (i >= seqCount)
-            {
-                Records[i].id = ids[i-seqCount];
-                Records[i].seq = &seqs[i];
-                Records[i].orientation = 1;
-            } else {
-                Records[i].id = ids[i];
-                Records[i].seq = &seqs[i];
-                Records[i].orientation = 0;
-            }
+            Records[i+seqCount].id = ids[i];
+            Records[i+seqCount].seq = ReferenceView(&seqs[i], &nRuns[i], true);
+            Records[i+seqCount].orientation = 1;
         }
     }
 }
@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <vector>
 
 #include <seqan/sequence.h>
@@ -9,6 +10,7 @@
 
 #include "config/SeqAnConfig.hpp"
 #include "config/Types.hpp"
+#include "ReferenceView.hpp"
 
 using namespace seqan;
 
@@ -21,25 +23,28 @@ namespace srsli {
         std::string faiFilename;
         FaiIndex faiIndex;
         StringSet<CharString> ids;
-        StringSet<TDna> seqs;
+        StringSet<TPackedDna> seqs;
+        std::vector<std::vector<NRun>> nRuns;
         size_t size;
         size_t seqCount;
+        uint64_t fingerprint;
 
     public:
         std::vector<ReferenceRecord> Records;
         size_t Size() const;
         size_t Length() const;
-        StringSet<CharString> Ids() const;
-        StringSet<TDna> Sequences() const;
-        seqan::FaiIndex FaiIndex() const;
+        uint64_t Fingerprint() const;
 
-    public:
-        template<typename TConfig = FindSeedsConfig<>>
-        Index<StringSet<TDna>, typename TConfig::IndexType> 
-            GetIndex();
+        // The loaded ids and sequences themselves, never copies of them
+        const StringSet<CharString>& Ids() const;
+        const StringSet<TPackedDna>& Sequences() const;
+        const seqan::FaiIndex& FaiIndex() const;
 
     public:
         ReferenceSet(const std::string& filename_);
+
+        // Every record views the set's sequences, so it stays put
+        ReferenceSet(const ReferenceSet&) = delete;
+        ReferenceSet& operator=(const ReferenceSet&) = delete;
     };
 }
-#include "ReferenceSetImpl.hpp"
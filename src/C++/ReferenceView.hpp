@@ -0,0 +1,125 @@
+// Author: Brett Bowman
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include <seqan/sequence.h>
+
+#include "config/SeqAnConfig.hpp"
+
+using namespace seqan;
+
+namespace srsli {
+
+    // A half-open run of N bases in a forward reference sequence, which the
+    //    2-bit packed storage itself can't represent
+    struct NRun {
+        size_t start;
+        size_t end;
+
+        NRun() {}
+
+        NRun(size_t s, size_t e)
+            : start( s )
+            , end( e )
+        {}
+    };
+
+    // Ordinal value used for N when unpacking, matching Dna5's
+    const uint8_t NOrdValue = 4;
+
+    /// A read-only view of one strand of a packed reference sequence.  The
+    ///   reverse strand is complemented on the fly, never stored
+    class ReferenceView {
+
+    private:
+        const TPackedDna* seq;
+        const std::vector<NRun>* nRuns;
+        bool reverse;
+
+    private:
+        // Copy the forward-strand ordinal values of [begin, end), with Ns restored
+        void CopyForwardOrdValues(uint8_t* out, size_t begin, size_t end) const
+        {
+            typedef Iterator<const TPackedDna, Standard>::Type TIterator;
+            TIterator it = iter(*seq, begin, Standard());
+            for (size_t i = begin; i < end; ++i, ++it)
+                out[i - begin] = ordValue(*it);
+
+            // Skip to the first run that could overlap us, then mask each overlap
+            std::vector<NRun>::const_iterator run = std::upper_bound(
+                    nRuns->begin(), nRuns->end(), begin,
+                    [](size_t pos, const NRun& r) { return pos < r.end; });
+            for ( ; run != nRuns->end() && run->start < end; ++run)
+            {
+                size_t maskStart = std::max(run->start, begin);
+                size_t maskEnd   = std::min(run->end,   end);
+                std::fill(out + (maskStart - begin), out + (maskEnd - begin), NOrdValue);
+            }
+        }
+
+    public:
+        size_t Length() const
+        {
+            return length(*seq);
+        }
+
+        bool IsReverse() const
+        {
+            return reverse;
+        }
+
+        // Copy the ordinal values (0-3 for ACGT, 4 for N) of [begin, end) into out
+        void CopyOrdValues(uint8_t* out, size_t begin, size_t end) const
+        {
+            if (!reverse)
+            {
+                CopyForwardOrdValues(out, begin, end);
+                return;
+            }
+
+            // [begin, end) on the reverse strand is [L-end, L-begin) on the forward
+            size_t len = Length();
+            size_t n = end - begin;
+            CopyForwardOrdValues(out, len - end, len - begin);
+            std::reverse(out, out + n);
+            for (size_t i = 0; i < n; ++i)
+                out[i] = (out[i] == NOrdValue) ? NOrdValue : 3 - out[i];
+        }
+
+        // Materialize [begin, end) of this strand as a Dna5String
+        void Infix(TDna& out, size_t begin, size_t end) const
+        {
+            static const char ordToChar[] = { 'A', 'C', 'G', 'T', 'N' };
+            std::vector<uint8_t> ords(end - begin);
+            CopyOrdValues(ords.data(), begin, end);
+
+            resize(out, end - begin, Exact());
+            for (size_t i = 0; i < ords.size(); ++i)
+                out[i] = ordToChar[ords[i]];
+        }
+
+        Dna5 operator[](size_t pos) const
+        {
+            uint8_t ord;
+            CopyOrdValues(&ord, pos, pos + 1);
+            return Dna5("ACGTN"[ord]);
+        }
+
+    public:
+        ReferenceView()
+            : seq( nullptr )
+            , nRuns( nullptr )
+            , reverse( false )
+        {}
+
+        ReferenceView(const TPackedDna* s, const std::vector<NRun>* n, bool r)
+            : seq( s )
+            , nRuns( n )
+            , reverse( r )
+        {}
+    };
+}
@@ -0,0 +1,207 @@
+// Author: Brett Bowman
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "ResultWriter.hpp"
+
+namespace srsli {
+
+    // Output is written in blocks of at least this many bytes
+    static const size_t OutputBufferSize = 1 << 20;
+
+    // BufferedSink
+    void BufferedSink::Flush()
+    {
+        WriteBuffer();
+        flushed = true;
+        if (fflush(out) != 0)
+            throw std::runtime_error("ERROR: Could not write the alignment output");
+    }
+
+    void BufferedSink::WriteIfFull()
+    {
+        if (buffer.size() >= OutputBufferSize)
+            WriteBuffer();
+    }
+
+    void BufferedSink::WriteBuffer()
+    {
+        if (fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size())
+            throw std::runtime_error("ERROR: Could not write the alignment output");
+        buffer.clear();
+    }
+
+    BufferedSink::BufferedSink(FILE* out_)
+        : out( out_ )
+        , flushed( false )
+    {
+        buffer.reserve(OutputBufferSize + 4096);
+    }
+
+    BufferedSink::~BufferedSink()
+    {
+        // Best effort only, when unwinding from an error; once flushed, the
+        //    caller is free to have closed the file before we go away
+        if (flushed)
+            return;
+        fwrite(buffer.data(), 1, buffer.size(), out);
+        fflush(out);
+    }
+
+    // M1Sink
+    void M1Sink::Write(AlignmentRecord& record)
+    {
+        buffer += record.toM1Record(refSet.Records[record.ReferenceIndex]);
+        buffer += '\n';
+        WriteIfFull();
+    }
+
+    M1Sink::M1Sink(FILE* out, const std::string& header, const ReferenceSet& refSet_)
+        : BufferedSink( out )
+        , refSet( refSet_ )
+    {
+        buffer += header;
+        buffer += '\n';
+    }
+
+    // ResultWriter
+    size_t ResultWriter::Reserve()
+    {
+        std::unique_lock<std::mutex> guard(stateLock);
+        batchWritten.wait(guard, [&]{ return nextSlot - nextToWrite < maxPending || firstError; });
+        if (firstError)
+            std::rethrow_exception(firstError);
+        return nextSlot++;
+    }
+
+    void ResultWriter::Deliver(const size_t slot,
+                               std::vector<AlignmentRecord>& records,
+                               const std::shared_ptr<const void>& owner)
+    {
+        std::unique_lock<std::mutex> guard(stateLock);
+        Batch& batch = delivered[slot];
+        batch.records.swap(records);
+        batch.owner = owner;
+        records.clear();
+        if (background)
+            batchDelivered.notify_one();
+        else
+            WriteReady(guard);
+    }
+
+    void ResultWriter::Close()
+    {
+        {
+            std::unique_lock<std::mutex> guard(stateLock);
+            closing = true;
+            if (!background)
+                WriteReady(guard);
+        }
+        if (writer.joinable())
+        {
+            batchDelivered.notify_one();
+            writer.join();
+        }
+
+        std::unique_lock<std::mutex> guard(stateLock);
+        if (firstError)
+            std::rethrow_exception(firstError);
+        if (nextToWrite != nextSlot)
+            throw std::runtime_error("ERROR: Closed the result writer with batches still outstanding");
+        sink.Flush();
+    }
+
+    size_t ResultWriter::RecordsWritten()
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        return recordsWritten;
+    }
+
+    // Private functions
+
+    // Write batches for as long as the next one due has been delivered,
+    //    releasing the lock while the sink formats them.  Only one caller
+    //    writes at a time, so batches can't overtake each other
+    void ResultWriter::WriteReady(std::unique_lock<std::mutex>& guard)
+    {
+        if (writing)
+            return;
+        writing = true;
+
+        Batch batch;
+        std::map<size_t, Batch>::iterator next;
+        while (!firstError && (next = delivered.find(nextToWrite)) != delivered.end())
+        {
+            batch.records.swap(next->second.records);
+            batch.owner.swap(next->second.owner);
+            delivered.erase(next);
+
+            guard.unlock();
+            try {
+                for (size_t i = 0; i < batch.records.size(); ++i)
+                    sink.Write(batch.records[i]);
+            } catch (...) {
+                guard.lock();
+                firstError = std::current_exception();
+                break;
+            }
+            guard.lock();
+
+            recordsWritten += batch.records.size();
+            batch.records.clear();
+            batch.owner.reset();
+            ++nextToWrite;
+            batchWritten.notify_all();
+        }
+
+        writing = false;
+        batchWritten.notify_all();
+    }
+
+    void ResultWriter::WriterLoop()
+    {
+        std::unique_lock<std::mutex> guard(stateLock);
+        while (true)
+        {
+            batchDelivered.wait(guard, [&]{
+                return closing || firstError || delivered.count(nextToWrite) > 0;
+            });
+            WriteReady(guard);
+            if (firstError || (closing && delivered.count(nextToWrite) == 0))
+                return;
+        }
+    }
+
+    // Constructors
+    ResultWriter::ResultWriter(ResultSink& sink_,
+                               const size_t maxPending_,
+                               const bool background_)
+        : sink( sink_ )
+        , maxPending( std::max<size_t>(maxPending_, 1) )
+        , background( background_ )
+        , nextSlot( 0 )
+        , nextToWrite( 0 )
+        , recordsWritten( 0 )
+        , writing( false )
+        , closing( false )
+    {
+        if (background)
+            writer = std::thread(&ResultWriter::WriterLoop, this);
+    }
+
+    ResultWriter::~ResultWriter()
+    {
+        // Abandon anything unwritten if we're unwinding from an error
+        if (writer.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> guard(stateLock);
+                closing = true;
+                delivered.clear();
+            }
+            batchDelivered.notify_one();
+            writer.join();
+        }
+    }
+}
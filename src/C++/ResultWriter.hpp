@@ -0,0 +1,126 @@
+// Author: Brett Bowman
+
+#pragma once
+
+#include <stdio.h>
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AlignmentRecord.hpp"
+#include "ReferenceSet.hpp"
+
+namespace srsli {
+
+    /// Somewhere to write finished alignment records, one at a time
+    class ResultSink {
+
+    public:
+        virtual void Write(AlignmentRecord& record) = 0;
+        virtual void Flush() = 0;
+        virtual ~ResultSink() {}
+    };
+
+    /// A sink writing text through a large buffer, so that the file is
+    ///   written in big blocks
+    class BufferedSink : public ResultSink {
+
+    private:
+        FILE* out;
+        bool flushed;
+
+    protected:
+        std::string buffer;
+
+    protected:
+        // Write the buffer out once it has grown large enough
+        void WriteIfFull();
+        void WriteBuffer();
+
+    public:
+        void Flush();
+
+    public:
+        BufferedSink(FILE* out);
+        ~BufferedSink();
+    };
+
+    /// Writes records in the M1 text format
+    class M1Sink : public BufferedSink {
+
+    private:
+        const ReferenceSet& refSet;
+
+    public:
+        void Write(AlignmentRecord& record);
+
+    public:
+        M1Sink(FILE* out, const std::string& header, const ReferenceSet& refSet);
+    };
+
+    /// Passes each batch of records to a sink once all the batches before it
+    ///   have been written, so output appears in input order as soon as it
+    ///   can.  Callers reserve a slot per batch before mapping it and deliver
+    ///   its records when done; reserving blocks while maxPending batches are
+    ///   waiting to be written, which bounds the records held in memory.  The
+    ///   sink is run on a writer thread of its own, or in the background's
+    ///   absence by whichever caller delivers the next batch due
+    class ResultWriter {
+
+    private:
+        ResultSink& sink;
+        const size_t maxPending;
+        const bool background;
+
+        std::mutex stateLock;
+        std::condition_variable batchDelivered;
+        std::condition_variable batchWritten;
+        // The records of each batch delivered, and whatever owns the queries
+        //    they point to
+        struct Batch {
+            std::vector<AlignmentRecord> records;
+            std::shared_ptr<const void> owner;
+        };
+        std::map<size_t, Batch> delivered;
+        size_t nextSlot;
+        size_t nextToWrite;
+        size_t recordsWritten;
+        bool writing;
+        bool closing;
+        std::exception_ptr firstError;
+        std::thread writer;
+
+    private:
+        void WriteReady(std::unique_lock<std::mutex>& guard);
+        void WriterLoop();
+
+    public:
+        // Reserve the output slot for the next batch, in input order
+        size_t Reserve();
+
+        // Hand over the records of a reserved slot, leaving records empty,
+        //    and hold on to the owner of their queries until they're written
+        void Deliver(const size_t slot,
+                     std::vector<AlignmentRecord>& records,
+                     const std::shared_ptr<const void>& owner);
+
+        // Write everything delivered and flush the sink, re-throwing the
+        //    first error the sink raised.  Every reserved slot must have
+        //    been delivered
+        void Close();
+
+        size_t RecordsWritten();
+
+    public:
+        ResultWriter(ResultSink& sink, const size_t maxPending, const bool background);
+        ~ResultWriter();
+
+        ResultWriter(const ResultWriter&) = delete;
+        ResultWriter& operator=(const ResultWriter&) = delete;
+    };
+}
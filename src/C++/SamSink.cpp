@@ -0,0 +1,254 @@
+// Author: Brett Bowman
+
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
+
+#include "parameters/Version.hpp"
+#include "SamSink.hpp"
+
+namespace srsli {
+
+    // SAM names end at the first whitespace of a Fasta/Fastq header line
+    static std::string SamName(const CharString& id)
+    {
+        std::string name(toCString(id));
+        size_t end = name.find_first_of(" \t");
+        return (end == std::string::npos) ? name : name.substr(0, end);
+    }
+
+    static char ComplementBase(const char base)
+    {
+        switch (base) {
+            case 'A': return 'T';
+            case 'C': return 'G';
+            case 'G': return 'C';
+            case 'T': return 'A';
+            default:  return 'N';
+        }
+    }
+
+    static void AppendCigarUnit(std::vector<CigarUnit>& cigar, const size_t length, const CigarOp op)
+    {
+        if (length > 0)
+            cigar.push_back(((CigarUnit)length << 4) | op);
+    }
+
+    // The BAM index bin of the reference interval [begin, end)
+    static uint16_t RegionToBin(const size_t begin, size_t end)
+    {
+        --end;
+        if (begin >> 14 == end >> 14) return ((1 << 15) - 1) / 7 + (begin >> 14);
+        if (begin >> 17 == end >> 17) return ((1 << 12) - 1) / 7 + (begin >> 17);
+        if (begin >> 20 == end >> 20) return ((1 << 9) - 1) / 7 + (begin >> 20);
+        if (begin >> 23 == end >> 23) return ((1 << 6) - 1) / 7 + (begin >> 23);
+        if (begin >> 26 == end >> 26) return ((1 << 3) - 1) / 7 + (begin >> 26);
+        return 0;
+    }
+
+    // BAM is little-endian throughout, as are the hosts we build for
+    template<typename TValue>
+    static void AppendBinary(std::string& out, const TValue value)
+    {
+        out.append((const char*)&value, sizeof(value));
+    }
+
+    void ToSamRecord(SamRecord& samRecord,
+                     AlignmentRecord& record,
+                     const ReferenceSet& refSet)
+    {
+        const ReferenceRecord& refRec = refSet.Records[record.ReferenceIndex];
+        const AlignmentStats& stats = record.Stats();
+        const bool reverse = (refRec.orientation == 1);
+
+        samRecord.queryName = (record.Query != NULL) ? SamName(record.Query->Id) : "*";
+        samRecord.flag = (reverse ? 0x10 : 0) | (record.IsSecondary ? 0x100 : 0);
+        samRecord.refIndex = record.ReferenceIndex % (refSet.Records.size() / 2);
+        samRecord.position = reverse ? record.ReferenceLength - record.ReferenceEnd()
+                                     : record.ReferenceStart();
+        samRecord.refSpan = stats.matches + stats.mismatches + stats.deletions;
+        samRecord.mappingQuality = record.MappingQuality;
+        samRecord.score = record.Score;
+        samRecord.editDistance = stats.mismatches + stats.insertions + stats.deletions;
+
+        samRecord.cigar.clear();
+        AppendCigarUnit(samRecord.cigar, record.QueryStart(), CigarSoftClip);
+        samRecord.cigar.insert(samRecord.cigar.end(), record.Cigar().begin(), record.Cigar().end());
+        AppendCigarUnit(samRecord.cigar, record.QueryLength - record.QueryEnd(), CigarSoftClip);
+
+        samRecord.readGroup = (record.Query != NULL) ? toCString(record.Query->ReadGroup) : "";
+        samRecord.zmw = (record.Query != NULL) ? record.Query->Zmw : -1;
+
+        samRecord.sequence.clear();
+        samRecord.qualities.clear();
+        if (!record.IsSecondary && record.Query != NULL)
+        {
+            const Dna5String& seq = record.Query->Seq;
+            samRecord.sequence.resize(length(seq));
+            for (size_t i = 0; i < length(seq); ++i)
+                samRecord.sequence[i] = (char)seq[i];
+            if (length(record.Query->Qual) == length(seq))
+                samRecord.qualities = toCString(record.Query->Qual);
+        }
+
+        if (reverse)
+        {
+            std::reverse(samRecord.cigar.begin(), samRecord.cigar.end());
+            std::reverse(samRecord.sequence.begin(), samRecord.sequence.end());
+            std::transform(samRecord.sequence.begin(), samRecord.sequence.end(),
+                           samRecord.sequence.begin(), ComplementBase);
+            std::reverse(samRecord.qualities.begin(), samRecord.qualities.end());
+        }
+    }
+
+    std::string SamHeader(const ReferenceSet& refSet, const std::string& readGroupHeader)
+    {
+        std::string header = "@HD\tVN:1.6\tSO:unknown\n";
+        for (size_t i = 0; i < refSet.Records.size() / 2; ++i)
+            header += "@SQ\tSN:" + SamName(refSet.Records[i].id) +
+                      "\tLN:" + std::to_string(refSet.Records[i].seq.Length()) + "\n";
+        header += readGroupHeader;
+        header += "@PG\tID:srsli\tPN:srsli\tVN:" + Version::VersionString() + "\n";
+        return header;
+    }
+
+    // SamSink
+    void SamSink::Write(AlignmentRecord& record)
+    {
+        static const char cigarOps[] = "MIDNSHP=X";
+        ToSamRecord(samRecord, record, refSet);
+
+        buffer += samRecord.queryName;
+        buffer += '\t' + std::to_string(samRecord.flag);
+        buffer += '\t' + SamName(refSet.Records[samRecord.refIndex].id);
+        buffer += '\t' + std::to_string(samRecord.position + 1);
+        buffer += '\t' + std::to_string(samRecord.mappingQuality);
+        buffer += '\t';
+        for (size_t i = 0; i < samRecord.cigar.size(); ++i)
+        {
+            buffer += std::to_string(samRecord.cigar[i] >> 4);
+            buffer += cigarOps[samRecord.cigar[i] & 0xF];
+        }
+        buffer += "\t*\t0\t0\t";
+        buffer += samRecord.sequence.empty() ? "*" : samRecord.sequence;
+        buffer += '\t';
+        buffer += samRecord.qualities.empty() ? "*" : samRecord.qualities;
+        buffer += "\tAS:i:" + std::to_string(samRecord.score);
+        buffer += "\tNM:i:" + std::to_string(samRecord.editDistance);
+        if (!samRecord.readGroup.empty())
+            buffer += "\tRG:Z:" + samRecord.readGroup;
+        if (samRecord.zmw >= 0)
+            buffer += "\tzm:i:" + std::to_string(samRecord.zmw);
+        buffer += '\n';
+        WriteIfFull();
+    }
+
+    SamSink::SamSink(FILE* out, const ReferenceSet& refSet_, const std::string& readGroupHeader)
+        : BufferedSink( out )
+        , refSet( refSet_ )
+    {
+        buffer += SamHeader(refSet, readGroupHeader);
+    }
+
+    // BamSink
+    void BamSink::Write(AlignmentRecord& record)
+    {
+        static const char baseCodes[] = "=ACMGRSVTWYHKDBN";
+        ToSamRecord(samRecord, record, refSet);
+        const std::string name = samRecord.queryName.substr(0, 254);
+        const size_t seqLength = samRecord.sequence.size();
+
+        // BAM can only hold 65535 CIGAR operations; longer alignments get a
+        //    placeholder, with the real CIGAR in a CG tag
+        std::vector<CigarUnit> longCigar;
+        if (samRecord.cigar.size() > 0xFFFF)
+        {
+            longCigar.swap(samRecord.cigar);
+            AppendCigarUnit(samRecord.cigar, record.QueryLength, CigarSoftClip);
+            AppendCigarUnit(samRecord.cigar, samRecord.refSpan, (CigarOp)3);
+        }
+
+        encoded.clear();
+        AppendBinary<int32_t>(encoded, 0);
+        AppendBinary<int32_t>(encoded, samRecord.refIndex);
+        AppendBinary<int32_t>(encoded, samRecord.position);
+        AppendBinary<uint8_t>(encoded, name.size() + 1);
+        AppendBinary<uint8_t>(encoded, samRecord.mappingQuality);
+        AppendBinary<uint16_t>(encoded, RegionToBin(samRecord.position,
+                                                    samRecord.position + std::max<size_t>(samRecord.refSpan, 1)));
+        AppendBinary<uint16_t>(encoded, samRecord.cigar.size());
+        AppendBinary<uint16_t>(encoded, samRecord.flag);
+        AppendBinary<int32_t>(encoded, seqLength);
+        AppendBinary<int32_t>(encoded, -1);
+        AppendBinary<int32_t>(encoded, -1);
+        AppendBinary<int32_t>(encoded, 0);
+        encoded.append(name.c_str(), name.size() + 1);
+        for (size_t i = 0; i < samRecord.cigar.size(); ++i)
+            AppendBinary<uint32_t>(encoded, samRecord.cigar[i]);
+
+        for (size_t i = 0; i < seqLength; i += 2)
+        {
+            uint8_t high = strchr(baseCodes, samRecord.sequence[i]) - baseCodes;
+            uint8_t low = (i + 1 < seqLength) ? strchr(baseCodes, samRecord.sequence[i+1]) - baseCodes : 0;
+            AppendBinary<uint8_t>(encoded, (high << 4) | low);
+        }
+        if (samRecord.qualities.empty())
+            encoded.append(seqLength, (char)0xFF);
+        else
+            for (size_t i = 0; i < seqLength; ++i)
+                AppendBinary<uint8_t>(encoded, samRecord.qualities[i] - 33);
+
+        encoded += "ASi";
+        AppendBinary<int32_t>(encoded, samRecord.score);
+        encoded += "NMi";
+        AppendBinary<int32_t>(encoded, samRecord.editDistance);
+        if (!samRecord.readGroup.empty())
+        {
+            encoded += "RGZ";
+            encoded.append(samRecord.readGroup.c_str(), samRecord.readGroup.size() + 1);
+        }
+        if (samRecord.zmw >= 0)
+        {
+            encoded += "zmi";
+            AppendBinary<int32_t>(encoded, samRecord.zmw);
+        }
+        if (!longCigar.empty())
+        {
+            encoded += "CGBI";
+            AppendBinary<uint32_t>(encoded, longCigar.size());
+            for (size_t i = 0; i < longCigar.size(); ++i)
+                AppendBinary<uint32_t>(encoded, longCigar[i]);
+        }
+
+        int32_t blockSize = encoded.size() - 4;
+        memcpy(&encoded[0], &blockSize, 4);
+        bgzf.Write(encoded.data(), encoded.size());
+    }
+
+    void BamSink::Flush()
+    {
+        bgzf.Close();
+    }
+
+    BamSink::BamSink(FILE* out,
+                     const ReferenceSet& refSet_,
+                     const std::string& readGroupHeader,
+                     const size_t compressionThreads)
+        : refSet( refSet_ )
+        , bgzf( out, compressionThreads )
+    {
+        std::string header = SamHeader(refSet, readGroupHeader);
+        encoded = "BAM\1";
+        AppendBinary<int32_t>(encoded, header.size());
+        encoded += header;
+        AppendBinary<int32_t>(encoded, refSet.Records.size() / 2);
+        for (size_t i = 0; i < refSet.Records.size() / 2; ++i)
+        {
+            std::string name = SamName(refSet.Records[i].id);
+            AppendBinary<int32_t>(encoded, name.size() + 1);
+            encoded.append(name.c_str(), name.size() + 1);
+            AppendBinary<int32_t>(encoded, refSet.Records[i].seq.Length());
+        }
+        bgzf.Write(encoded.data(), encoded.size());
+    }
+}
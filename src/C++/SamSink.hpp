@@ -0,0 +1,80 @@
+// Author: Brett Bowman
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "AlignmentRecord.hpp"
+#include "BgzfWriter.hpp"
+#include "ReferenceSet.hpp"
+#include "ResultWriter.hpp"
+
+namespace srsli {
+
+    /// The fields of one SAM/BAM record, in forward reference coordinates
+    struct SamRecord {
+        std::string queryName;
+        int flag;
+        size_t refIndex;
+        size_t position;
+        size_t refSpan;
+        int mappingQuality;
+        std::vector<CigarUnit> cigar;
+        std::string sequence;
+        std::string qualities;
+        long score;
+        size_t editDistance;
+        std::string readGroup;
+        int64_t zmw;
+    };
+
+    /// Convert an alignment to SAM's conventions: reverse-strand alignments
+    ///   are flipped onto the forward strand with the query reverse
+    ///   complemented, and unaligned query ends become soft clips.
+    ///   Secondary alignments leave out the query's bases and qualities.
+    ///   The query's read group and ZMW, if it has them, are kept as tags
+    void ToSamRecord(SamRecord& samRecord,
+                     AlignmentRecord& record,
+                     const ReferenceSet& refSet);
+
+    /// The SAM header text: the reference sequences, the queries' read
+    ///   groups and this program
+    std::string SamHeader(const ReferenceSet& refSet, const std::string& readGroupHeader);
+
+    /// Writes records as SAM text
+    class SamSink : public BufferedSink {
+
+    private:
+        const ReferenceSet& refSet;
+        SamRecord samRecord;
+
+    public:
+        void Write(AlignmentRecord& record);
+
+    public:
+        SamSink(FILE* out, const ReferenceSet& refSet, const std::string& readGroupHeader);
+    };
+
+    /// Writes records as BAM, compressing its BGZF blocks in parallel
+    class BamSink : public ResultSink {
+
+    private:
+        const ReferenceSet& refSet;
+        BgzfWriter bgzf;
+        SamRecord samRecord;
+        std::string encoded;
+
+    public:
+        void Write(AlignmentRecord& record);
+        void Flush();
+
+    public:
+        BamSink(FILE* out,
+                const ReferenceSet& refSet,
+                const std::string& readGroupHeader,
+                const size_t compressionThreads);
+    };
+}
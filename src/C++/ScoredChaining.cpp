@@ -0,0 +1,257 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <seqan/seeds.h>
+
+#include "config/SeqAnConfig.hpp"
+#include "config/Types.hpp"
+#include "utils/MaxTree.cpp"
+#include "utils/Seed.cpp"
+#include "utils/SeedChain.cpp"
+#include "utils/ReferencedSeedChain.cpp"
+
+using namespace seqan;
+using namespace srsli;
+
+// Gap costs for the scored chainer, in the same units as the seed scores
+struct ChainScoring {
+    float gapCost;      // Per base of gap, averaged over the two sequences
+    float indelCost;    // Per base of net indel between two seeds
+    size_t lookback;    // Predecessors to score exactly before each seed
+
+    ChainScoring(float g, float i, size_t l)
+        : gapCost( g )
+        , indelCost( i )
+        , lookback( l )
+    {}
+};
+
+// The chaining state of one seed for the scored chainer
+struct ScoredChainLink {
+    float score;
+    size_t prev;
+};
+
+// A released seed's entry in the chaining MaxTree.  The key is its chain
+//    score with the gap cost from the origin added back, so that subtracting
+//    the next seed's own distance from the origin gives the linear gap cost
+struct ScoredChainEntry {
+    float key;
+    size_t idx;
+
+    bool operator<(const ScoredChainEntry& other) const
+    {
+        return key < other.key;
+    }
+};
+
+// Working space for ScoreSeedChains and ScoredSeedChains, kept by each
+//    worker and reused between queries
+struct ScoredChainBuffers {
+    std::vector<ScoredChainLink> links;
+    std::vector<size_t> byQueryEnd;
+    std::vector<size_t> rank;
+    std::vector<size_t> queryEnds;
+    std::vector<std::pair<size_t, size_t>> pending;
+    std::vector<std::pair<size_t, size_t>> live;
+    std::vector<size_t> byScore;
+    std::vector<bool> used;
+    std::vector<size_t> chainSeeds;
+    ReferencedSeedChain refChain;
+    MaxTree<ScoredChainEntry> tree;
+};
+
+
+// The cost of following seed i with seed j: linear in the length of the gap
+//    between them, plus a concave (linear + log) cost for the net indel
+template<typename TSeed>
+inline float ChainGapCost(const TSeed& i, const TSeed& j, const ChainScoring& scoring)
+{
+    float queryGap = beginPositionH(j) - endPositionH(i);
+    float refGap = beginPositionV(j) - endPositionV(i);
+    float indel = fabs(refGap - queryGap);
+    float cost = scoring.gapCost * 0.5 * (queryGap + refGap);
+    if (indel > 0)
+        cost += scoring.indelCost * indel + 0.5 * log2(indel);
+    return cost;
+}
+
+
+// Score the best chain ending at each of one reference's position-sorted
+//    seeds, weighting each seed by its score.  Candidate predecessors are
+//    those ending before the seed in both sequences and starting less than
+//    maxSpan reference bases before it.  The best of them under the linear
+//    gap cost alone comes from a MaxTree over query ends in O(log n); the
+//    concave indel cost is then charged exactly to it and to the lookback
+//    seeds immediately before this one, which usually include the best match
+template<typename TSeed>
+void ScoreSeedChains(ScoredChainBuffers& buffers,
+                     const std::vector<TSeed>& seeds,
+                     const size_t maxSpan,
+                     const ChainScoring& scoring)
+{
+    typedef std::pair<size_t, size_t> TQueued;
+    std::greater<TQueued> earlier;
+    size_t n = seeds.size();
+    std::vector<ScoredChainLink>& links = buffers.links;
+    links.resize(n);
+
+    // Rank the seeds by query end, so "ends before this seed" is a prefix
+    buffers.byQueryEnd.resize(n);
+    for (size_t i = 0; i < n; ++i)
+        buffers.byQueryEnd[i] = i;
+    std::sort(buffers.byQueryEnd.begin(), buffers.byQueryEnd.end(), [&](size_t a, size_t b) {
+        return endPositionH(seeds[a]) < endPositionH(seeds[b]);
+    });
+    buffers.rank.resize(n);
+    buffers.queryEnds.resize(n);
+    for (size_t r = 0; r < n; ++r)
+    {
+        buffers.rank[buffers.byQueryEnd[r]] = r;
+        buffers.queryEnds[r] = endPositionH(seeds[buffers.byQueryEnd[r]]);
+    }
+
+    const ScoredChainEntry none = { -INFINITY, SIZE_MAX };
+    buffers.tree.Reset(n, none);
+    buffers.pending.clear();
+    buffers.live.clear();
+
+    for (size_t j = 0; j < n; ++j)
+    {
+        size_t beginV = beginPositionV(seeds[j]);
+        size_t beginH = beginPositionH(seeds[j]);
+
+        // Release the seeds this one could follow, and drop those too far behind
+        while (!buffers.pending.empty() && buffers.pending.front().first <= beginV)
+        {
+            size_t i = buffers.pending.front().second;
+            std::pop_heap(buffers.pending.begin(), buffers.pending.end(), earlier);
+            buffers.pending.pop_back();
+            float origin = scoring.gapCost * 0.5 * (endPositionH(seeds[i]) + endPositionV(seeds[i]));
+            ScoredChainEntry entry = { links[i].score + origin, i };
+            buffers.tree.Set(buffers.rank[i], entry);
+            buffers.live.push_back(TQueued(beginPositionV(seeds[i]), i));
+            std::push_heap(buffers.live.begin(), buffers.live.end(), earlier);
+        }
+        while (!buffers.live.empty() && buffers.live.front().first + maxSpan <= beginV)
+        {
+            buffers.tree.Clear(buffers.rank[buffers.live.front().second]);
+            std::pop_heap(buffers.live.begin(), buffers.live.end(), earlier);
+            buffers.live.pop_back();
+        }
+
+        ScoredChainLink link = { (float)score(seeds[j]), SIZE_MAX };
+        float bestPrev = 0;
+
+        size_t numBefore = std::upper_bound(buffers.queryEnds.begin(), buffers.queryEnds.end(),
+                                            beginH) - buffers.queryEnds.begin();
+        ScoredChainEntry best = buffers.tree.PrefixMax(numBefore);
+        if (best.idx != SIZE_MAX)
+        {
+            float value = links[best.idx].score - ChainGapCost(seeds[best.idx], seeds[j], scoring);
+            if (value > bestPrev)
+            {
+                bestPrev = value;
+                link.prev = best.idx;
+            }
+        }
+
+        for (size_t i = j; i > 0 && j - i < scoring.lookback; --i)
+        {
+            const TSeed& prev = seeds[i-1];
+            if (beginPositionV(prev) + maxSpan <= beginV)
+                break;
+            if ((size_t)endPositionV(prev) > beginV || (size_t)endPositionH(prev) > beginH)
+                continue;
+            float value = links[i-1].score - ChainGapCost(prev, seeds[j], scoring);
+            if (value > bestPrev)
+            {
+                bestPrev = value;
+                link.prev = i-1;
+            }
+        }
+
+        link.score += bestPrev;
+        links[j] = link;
+        buffers.pending.push_back(TQueued(endPositionV(seeds[j]), j));
+        std::push_heap(buffers.pending.begin(), buffers.pending.end(), earlier);
+    }
+}
+
+
+// Chain each reference's seeds with ScoreSeedChains, then read the chains
+//    out best-first, skipping any that shares a seed with a better chain,
+//    and rank every chain found by its score
+template<typename TSeed>
+int ScoredSeedChains(std::vector<ReferencedSeedChain>& chains,
+                     const SeedBuckets<TSeed>& seedBuckets,
+                     const size_t maxSpan,
+                     const ChainScoring& scoring,
+                     ScoredChainBuffers& buffers)
+{
+    size_t minSeedChainBases = 30;
+    ReferencedSeedChain& refChain = buffers.refChain;
+
+    for (size_t bucket = 0; bucket < seedBuckets.size(); ++bucket)
+    {
+        const std::vector<TSeed>& seeds = seedBuckets.Seeds(bucket);
+        if (seeds.empty())
+            continue;
+        ScoreSeedChains(buffers, seeds, maxSpan, scoring);
+
+        const std::vector<ScoredChainLink>& links = buffers.links;
+        buffers.byScore.resize(seeds.size());
+        for (size_t i = 0; i < seeds.size(); ++i)
+            buffers.byScore[i] = i;
+        std::sort(buffers.byScore.begin(), buffers.byScore.end(), [&](size_t a, size_t b) {
+            return links[a].score > links[b].score;
+        });
+        buffers.used.assign(seeds.size(), false);
+
+        for (size_t k = 0; k < buffers.byScore.size(); ++k)
+        {
+            size_t last = buffers.byScore[k];
+            if (buffers.used[last])
+                continue;
+
+            // Walk back to the first seed, giving up on chains that run into a
+            //    better one, since they are only weaker versions of it
+            bool overlaps = false;
+            buffers.chainSeeds.clear();
+            for (size_t s = last; s != SIZE_MAX; s = links[s].prev)
+            {
+                if (buffers.used[s])
+                {
+                    overlaps = true;
+                    break;
+                }
+                buffers.chainSeeds.push_back(s);
+            }
+            for (size_t s = 0; s < buffers.chainSeeds.size(); ++s)
+                buffers.used[buffers.chainSeeds[s]] = true;
+            if (overlaps)
+                continue;
+
+            refChain.referenceIndex = seedBuckets.Reference(bucket);
+            refChain.score = links[last].score;
+            clear(refChain.chain);
+            for (size_t s = buffers.chainSeeds.size(); s > 0; --s)
+                appendValue(refChain.chain, seeds[buffers.chainSeeds[s-1]]);
+
+            // Skip seed chains with very little supporting evidence
+            if (minSeedChainBases > SumSeedChainBases(refChain.chain))
+                continue;
+            chains.push_back(refChain);
+        }
+    }
+
+    std::sort(chains.begin(), chains.end(), refSeedChainScoreComparer);
+
+    // If we made it this far, return 0 for successful completion
+    return 0;
+}
@@ -1,7 +1,12 @@
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
 #include <vector>
 
 #include <seqan/seeds.h>
 
+#include "utils/MaxTree.cpp"
+#include "utils/RadixSort.cpp"
 #include "utils/Seed.cpp"
 #include "utils/SeedChain.cpp"
 #include "utils/ReferencedSeedChain.cpp"
@@ -12,28 +17,56 @@
 using namespace seqan;
 using namespace srsli;
 
+// Merge the raw seed hits of a query into maximal seeds and split them into
+//    one bucket per reference record hit, each sorted by reference position.  The
+//    hits are radix sorted by (record, diagonal, query position) so that
+//    overlapping hits on a diagonal sit next to each other and can be merged
+//    in one pass, then sorted again by (record, reference position)
 template<typename TSeed>
-void SeedSetsToSeedVectors(std::vector<TSeedSet>& sets,
-                           std::vector<std::vector<TSeed>>& vectors)
+void SeedHitsToSeedBuckets(std::vector<SeedHit>& hits,
+                           std::vector<SeedHit>& buffer,
+                           SeedBuckets<TSeed>& buckets)
 {
-    typedef seqan::Iterator<TSeedSet>::Type TIter;
-
-    // Iterate over each set, each containing the hits to one reference
-    for (size_t i = 0; i < sets.size(); ++i)
+    // Sort by the least significant key first, relying on each pass being stable
+    RadixSortByKey(hits, buffer, [](const SeedHit& h) { return uint64_t(h.queryPos); });
+    RadixSortByKey(hits, buffer, [](const SeedHit& h) {
+        return uint64_t(h.refPos) + UINT32_MAX - h.queryPos;
+    });
+    RadixSortByKey(hits, buffer, [](const SeedHit& h) { return uint64_t(h.ref); });
+
+    // Extend each seed over every later hit on its diagonal that touches it
+    size_t numMerged = 0;
+    for (size_t i = 0; i < hits.size(); ++i)
     {
-        // Initialize destination Seed vector to the appropriate size
-        vectors[i] = std::vector<TSeed>( length(sets[i]) );
-
-        // Iterate over each seed, adding it to the vector
-        size_t j = 0;
-        for (TIter it = begin(sets[i], seqan::Standard()); it != end(sets[i], seqan::Standard()); ++it)
+        const SeedHit& hit = hits[i];
+        if (numMerged > 0)
         {
-            vectors[i][j] = *it;
-            ++j;
+            SeedHit& last = hits[numMerged-1];
+            if (last.ref == hit.ref &&
+                last.refPos - last.queryPos == hit.refPos - hit.queryPos &&
+                hit.queryPos <= last.queryPos + last.length)
+            {
+                last.length = std::max(last.length, hit.queryPos + hit.length - last.queryPos);
+                last.score += hit.score;
+                continue;
+            }
         }
+        hits[numMerged++] = hit;
+    }
+    hits.resize(numMerged);
 
-        // Sort each vector after it's been filled by reference position
-        std::sort(vectors[i].begin(), vectors[i].end(), seedReferencePositionComparer);
+    RadixSortByKey(hits, buffer, [](const SeedHit& h) { return uint64_t(h.refPos); });
+    RadixSortByKey(hits, buffer, [](const SeedHit& h) { return uint64_t(h.ref); });
+
+    buckets.Clear();
+    std::vector<TSeed>* bucket = NULL;
+    for (size_t i = 0; i < hits.size(); ++i)
+    {
+        if (i == 0 || hits[i].ref != hits[i-1].ref)
+            bucket = &buckets.Add(hits[i].ref);
+        TSeed seed(hits[i].queryPos, hits[i].refPos, hits[i].length);
+        setScore(seed, hits[i].score);
+        bucket->push_back(seed);
     }
 }
 
@@ -64,27 +97,28 @@ int AdvanceIndexToIntervalEnd(const std::vector<TSeed>& seeds,
 
 template<typename TSeed>
 int GetSeedIntervals(std::vector<SeedInterval>& intervals,
-                     const std::vector<std::vector<TSeed>>& seedHits,
+                     const SeedBuckets<TSeed>& seedHits,
                      const size_t& maxIntervalSize)
 {
-    // Iterate over each SeedSet, looking for intervals in each
-    for (size_t refIdx = 0; refIdx < seedHits.size(); ++refIdx)
+    // Iterate over each seed bucket, looking for intervals in each
+    for (size_t bucket = 0; bucket < seedHits.size(); ++bucket)
     {
-        size_t nSeeds = length(seedHits[refIdx]);
+        const std::vector<TSeed>& seeds = seedHits.Seeds(bucket);
+        size_t nSeeds = length(seeds);
         size_t currEndIdx = 1, prevEndIdx = 0;
 
         // Iterate over each seed, treating it as a possible interval start index
         for (size_t startIdx = 0; startIdx < nSeeds; ++startIdx)
         {
             // Find the last possible Seed for an interval starting at startIdx
-            AdvanceIndexToIntervalEnd(seedHits[refIdx], nSeeds, maxIntervalSize, startIdx, currEndIdx);
+            AdvanceIndexToIntervalEnd(seeds, nSeeds, maxIntervalSize, startIdx, currEndIdx);
 
             // If the end index hasn't move skip to the next iteration
             if (currEndIdx == prevEndIdx)
                 continue;
 
             // Otherwise save the current interval and terminal index
-            SeedInterval currInterval(refIdx, startIdx, currEndIdx);
+            SeedInterval currInterval(bucket, startIdx, currEndIdx);
             intervals.push_back(currInterval);
             prevEndIdx = currEndIdx;
 
@@ -120,66 +154,308 @@ int SeedSetFromSeedInterval(TSeedSet& seedSet,
 }
 
 
-template<typename TSeed>
-int SeedIntervalsToSeedChains(std::vector<ReferencedSeedChain>& chains,
-                              const std::vector<std::vector<TSeed>>& seedVecs,
-                              const std::vector<SeedInterval>& intervals)
+// Tracks the last chain KeepNovelSeedChain kept, to compare the next one to
+struct SeedChainFilter {
+    size_t prevIdx;
+    int prevStartPos;
+    int prevEndPos;
+
+    SeedChainFilter()
+        : prevIdx( 0 )
+        , prevStartPos( 0 )
+        , prevEndPos( 0 )
+    {}
+};
+
+
+// Add a candidate chain to the list, unless it has too little supporting
+//    evidence or only trims the ends of the chain kept before it
+void KeepNovelSeedChain(std::vector<ReferencedSeedChain>& chains,
+                        const ReferencedSeedChain& refChain,
+                        SeedChainFilter& filter)
 {
     size_t minSeedChainBases = 30;
 
-    // Allocate a seedSet and chain for intermediate use
+    // Skip seed chains with very little supporting evidence
+    if (minSeedChainBases > SumSeedChainBases(refChain.chain))
+        return;
+
+    // If we pass that first filter, we calculate Start and End positions
+    int startPos = beginPositionV(refChain.chain);
+    int endPos = endPositionV(refChain.chain);
+
+    // If this is the first chain
+    if (chains.size() == 0)
+    {
+        // .. we automatically keep the chain and its Start and End positions
+        chains.push_back(refChain);
+        filter.prevStartPos = startPos;
+        filter.prevEndPos = endPos;
+
+    // If we have the same start but a longer end, replace the previous chain
+    } else if (startPos == filter.prevStartPos && endPos > filter.prevEndPos ) {
+        chains[filter.prevIdx] = refChain;
+
+    // On the other hand, if we have the same end and a lesser-or-matching start, skip it
+    } else if (startPos >= filter.prevStartPos && endPos == filter.prevEndPos) {
+        return;
+
+    // Finally, if neither of these is true and we have a novel chain, add it
+    } else {
+        chains.push_back(refChain);
+        filter.prevStartPos = startPos;
+        filter.prevEndPos = endPos;
+        filter.prevIdx++;
+    }
+}
+
+
+// The chaining state of one seed: the score (in bases) of the best chain
+//    ending with it, the seed before it in that chain, and the chain's first seed
+struct SeedChainLink {
+    size_t score;
+    size_t prev;
+    size_t first;
+};
+
+// A chain end, ordered by score and then by the latest-starting chain, since
+//    that one fits in the most intervals
+struct SeedChainEntry {
+    size_t score;
+    size_t first;
+    size_t last;
+
+    bool operator<(const SeedChainEntry& other) const
+    {
+        if (score != other.score)
+            return score < other.score;
+        return first < other.first;
+    }
+};
+
+// Working space for ChainSeedRange, reused between calls
+struct SeedChainBuffers {
+    std::vector<size_t> byQueryEnd;
+    std::vector<size_t> rank;
+    std::vector<size_t> queryEnds;
+    std::vector<std::pair<size_t, size_t>> pending;
+    std::vector<std::pair<size_t, size_t>> live;
+    MaxTree<SeedChainEntry> tree;
+};
+
+// Working space for the interval chainers, kept by each worker and reused
+//    from one query to the next
+struct SeedChainScratch {
     TSeedSet seedSet;
     ReferencedSeedChain refChain;
-    size_t prevIdx = 0;
-    int endPos, prevEndPos;
-    int startPos, prevStartPos;
-    size_t numChainBases;
+    std::vector<SeedChainLink> links;
+    std::vector<SeedChainLink> intervalLinks;
+    std::vector<size_t> chainSeeds;
+    std::vector<SeedChainEntry> chainEnds;
+    SeedChainBuffers ranges;
+};
+
+
+// Find the best chain ending with each seed in [begin, end) of one reference's
+//    position-sorted seeds, using only seeds from that range.  A seed can follow
+//    any earlier seed that ends before it starts in both sequences, and that
+//    starts less than maxSpan reference bases before it.  Sweeping in reference
+//    order, each seed is released into a MaxTree keyed by its query end once
+//    the sweep has passed its reference end, and dropped again once it falls
+//    maxSpan behind
+template<typename TSeed>
+void ChainSeedRange(std::vector<SeedChainLink>& links,
+                    SeedChainBuffers& buffers,
+                    const std::vector<TSeed>& seeds,
+                    const size_t begin,
+                    const size_t end,
+                    const size_t maxSpan = SIZE_MAX)
+{
+    typedef std::pair<size_t, size_t> TQueued;
+    std::greater<TQueued> laterEnd;
+    size_t n = end - begin;
+
+    // Rank the seeds by query end, so "ends before this seed" is a prefix
+    std::vector<size_t>& byQueryEnd = buffers.byQueryEnd;
+    byQueryEnd.resize(n);
+    for (size_t i = 0; i < n; ++i)
+        byQueryEnd[i] = begin + i;
+    std::sort(byQueryEnd.begin(), byQueryEnd.end(), [&](size_t a, size_t b) {
+        return endPositionH(seeds[a]) < endPositionH(seeds[b]);
+    });
+    buffers.rank.resize(n);
+    buffers.queryEnds.resize(n);
+    for (size_t r = 0; r < n; ++r)
+    {
+        buffers.rank[byQueryEnd[r] - begin] = r;
+        buffers.queryEnds[r] = endPositionH(seeds[byQueryEnd[r]]);
+    }
+
+    const SeedChainEntry none = { 0, 0, SIZE_MAX };
+    buffers.tree.Reset(n, none);
+    buffers.pending.clear();   // min-heap of (reference end, seed) not yet in the tree
+    buffers.live.clear();      // min-heap of (reference begin, seed) in the tree
+
+    for (size_t j = begin; j < end; ++j)
+    {
+        size_t beginV = beginPositionV(seeds[j]);
+        while (!buffers.pending.empty() && buffers.pending.front().first <= beginV)
+        {
+            size_t i = buffers.pending.front().second;
+            std::pop_heap(buffers.pending.begin(), buffers.pending.end(), laterEnd);
+            buffers.pending.pop_back();
+            SeedChainEntry entry = { links[i].score, links[i].first, i };
+            buffers.tree.Set(buffers.rank[i - begin], entry);
+            buffers.live.push_back(TQueued(beginPositionV(seeds[i]), i));
+            std::push_heap(buffers.live.begin(), buffers.live.end(), laterEnd);
+        }
+        while (!buffers.live.empty() && maxSpan != SIZE_MAX &&
+               buffers.live.front().first + maxSpan <= beginV)
+        {
+            buffers.tree.Clear(buffers.rank[buffers.live.front().second - begin]);
+            std::pop_heap(buffers.live.begin(), buffers.live.end(), laterEnd);
+            buffers.live.pop_back();
+        }
+
+        size_t numBefore = std::upper_bound(buffers.queryEnds.begin(), buffers.queryEnds.end(),
+                                            (size_t)beginPositionH(seeds[j]))
+                           - buffers.queryEnds.begin();
+        SeedChainEntry best = buffers.tree.PrefixMax(numBefore);
+        size_t numBases = GetSeedNumBases(seeds[j]);
+        SeedChainLink link = { numBases, SIZE_MAX, j };
+        if (best.score > 0)
+        {
+            link.score += best.score;
+            link.prev = best.last;
+            link.first = best.first;
+        }
+        links[j] = link;
+
+        buffers.pending.push_back(TQueued(endPositionV(seeds[j]), j));
+        std::push_heap(buffers.pending.begin(), buffers.pending.end(), laterEnd);
+    }
+}
+
+
+template<typename TSeed>
+int SeedIntervalsToSeedChains(std::vector<ReferencedSeedChain>& chains,
+                              const SeedBuckets<TSeed>& seedBuckets,
+                              const std::vector<SeedInterval>& intervals,
+                              SeedChainScratch& scratch)
+{
+    TSeedSet& seedSet = scratch.seedSet;
+    ReferencedSeedChain& refChain = scratch.refChain;
+    SeedChainFilter filter;
 
     for (size_t i = 0; i < intervals.size(); ++i)
     {
         // First identify the Reference / Anchor list we will be using
-        ReferencedSeedChain refChain;
-        refChain.referenceIndex = std::get<0>(intervals[i]);
+        size_t bucket = std::get<0>(intervals[i]);
+        refChain.referenceIndex = seedBuckets.Reference(bucket);
 
         // Fill the seed set with the appropriate seeds and Chain
         clear(seedSet);
         SeedSetFromSeedInterval(seedSet, 
                                 intervals[i], 
-                                seedVecs[refChain.referenceIndex]);
+                                seedBuckets.Seeds(bucket));
 
-        // Chain the seeds together and find the chain's start and end points
+        // Chain the seeds together and keep the chain if it's novel
+        clear(refChain.chain);
         chainSeedsGlobally(refChain.chain, seedSet, SparseChaining());
-     
-        // Skip seed chains with very little supporting evidence
-        if (minSeedChainBases > SumSeedChainBases(refChain.chain))
-            continue;
+        KeepNovelSeedChain(chains, refChain, filter);
+    }
+
+    // Finally, we sort the SeedChains we found by the number of bp matches they represent
+    std::sort(chains.begin(), chains.end(), refSeedChainNumBasesComparer);
+
+    // If we made it this far, return 0 for successful completion
+    return 0;
+}
 
-        // If we pass that first filter, we calculate Start and End positions
-        startPos = beginPositionV(refChain.chain);
-        endPos = endPositionV(refChain.chain);
 
-        // If this is the first chain
-        if (chains.size() == 0)
+// Chain the seeds of every interval like SeedIntervalsToSeedChains, without
+//    re-chaining each overlapping interval from scratch.  One ChainSeedRange
+//    sweep per reference finds the best chain ending at every seed, where each
+//    step spans less than an interval.  Every chain inside an interval meets
+//    that, so sliding through the intervals, a lazily-pruned max-heap gives the
+//    best of those ending inside the current one, and if that chain also starts
+//    inside it no chain in the interval can beat it.  Only when it starts too
+//    early is the interval chained on its own, so the chains are the same as
+//    re-chaining every interval
+template<typename TSeed>
+int SlideSeedIntervalsToSeedChains(std::vector<ReferencedSeedChain>& chains,
+                                   const SeedBuckets<TSeed>& seedBuckets,
+                                   const std::vector<SeedInterval>& intervals,
+                                   const size_t& maxIntervalSize,
+                                   SeedChainScratch& scratch)
+{
+    std::vector<SeedChainLink>& links = scratch.links;
+    std::vector<SeedChainLink>& intervalLinks = scratch.intervalLinks;
+    SeedChainBuffers& buffers = scratch.ranges;
+    std::vector<size_t>& chainSeeds = scratch.chainSeeds;
+    ReferencedSeedChain& refChain = scratch.refChain;
+    SeedChainFilter filter;
+
+    for (size_t i = 0; i < intervals.size(); )
+    {
+        size_t bucket = std::get<0>(intervals[i]);
+        const std::vector<TSeed>& seeds = seedBuckets.Seeds(bucket);
+        links.resize(seeds.size());
+        intervalLinks.resize(seeds.size());
+        ChainSeedRange(links, buffers, seeds, 0, seeds.size(), maxIntervalSize);
+
+        // A max-heap of the chain ending at each seed passed so far
+        std::vector<SeedChainEntry>& chainEnds = scratch.chainEnds;
+        chainEnds.clear();
+        size_t nextSeed = 0;
+        size_t prevFirst = SIZE_MAX, prevLast = SIZE_MAX;
+        for ( ; i < intervals.size() && std::get<0>(intervals[i]) == bucket; ++i)
         {
-            // .. we automatically keep the chain and its Start and End positions
-            chains.push_back(refChain);
-            prevStartPos = startPos;
-            prevEndPos = endPos;
-
-        // If we have the same start but a longer end, replace the previous chain
-        } else if (startPos == prevStartPos && endPos > prevEndPos ) {
-            chains[prevIdx] = refChain;
-
-        // On the other hand, if we have the same end and a lesser-or-matching start, skip it
-        } else if (startPos >= prevStartPos && endPos == prevEndPos) {
-            continue;
-
-        // Finally, if neither of these is true and we have a novel chain, add it
-        } else {
-            chains.push_back(refChain);
-            prevStartPos = startPos;
-            prevEndPos = endPos;
-            prevIdx++;
+            size_t start = std::get<1>(intervals[i]);
+            size_t end = std::get<2>(intervals[i]);
+            for ( ; nextSeed < end; ++nextSeed)
+            {
+                SeedChainEntry entry = { links[nextSeed].score, links[nextSeed].first, nextSeed };
+                chainEnds.push_back(entry);
+                std::push_heap(chainEnds.begin(), chainEnds.end());
+            }
+            while (!chainEnds.empty() && chainEnds.front().last < start)
+            {
+                std::pop_heap(chainEnds.begin(), chainEnds.end());
+                chainEnds.pop_back();
+            }
+            if (chainEnds.empty())
+                continue;
+
+            // Take the best chain if it fits, otherwise chain this interval alone
+            const std::vector<SeedChainLink>* chainLinks = &links;
+            SeedChainEntry best = chainEnds.front();
+            if (best.first < start)
+            {
+                ChainSeedRange(intervalLinks, buffers, seeds, start, end);
+                best.score = 0;
+                for (size_t j = start; j < end; ++j)
+                {
+                    SeedChainEntry entry = { intervalLinks[j].score, intervalLinks[j].first, j };
+                    best = std::max(best, entry);
+                }
+                chainLinks = &intervalLinks;
+            }
+
+            // Consecutive intervals often share their best chain
+            if (best.first == prevFirst && best.last == prevLast)
+                continue;
+            prevFirst = best.first;
+            prevLast = best.last;
+
+            chainSeeds.clear();
+            for (size_t s = best.last; s != SIZE_MAX; s = (*chainLinks)[s].prev)
+                chainSeeds.push_back(s);
+            refChain.referenceIndex = seedBuckets.Reference(bucket);
+            clear(refChain.chain);
+            for (size_t s = chainSeeds.size(); s > 0; --s)
+                appendValue(refChain.chain, seeds[chainSeeds[s-1]]);
+            KeepNovelSeedChain(chains, refChain, filter);
         }
     }
 
@@ -11,8 +11,9 @@
 using namespace seqan;
 
 template<typename TSeed>
-void SeedSetsToSeedVectors(std::vector<TSeedSet>& sets,
-                           std::vector<std::vector<TSeed>>& strings);
+void SeedHitsToSeedBuckets(std::vector<SeedHit>& hits,
+                           std::vector<SeedHit>& buffer,
+                           SeedBuckets<TSeed>& buckets);
 
 template<typename TSeed>
 int AdvanceIndexToIntervalEnd(const TSeedSet& seedSet,
@@ -23,4 +24,14 @@ int AdvanceIndexToIntervalEnd(const TSeedSet& seedSet,
 
 template<typename TSeed>
 int  GetSeedIntervals(std::vector<SeedInterval>& intervals,
-                      std::vector<TSeedSet>& seedSets);
+                      const SeedBuckets<TSeed>& seedHits,
+                      const size_t& maxIntervalSize);
+
+struct SeedChainScratch;
+
+template<typename TSeed>
+int SlideSeedIntervalsToSeedChains(std::vector<ReferencedSeedChain>& chains,
+                                   const SeedBuckets<TSeed>& seedBuckets,
+                                   const std::vector<SeedInterval>& intervals,
+                                   const size_t& maxIntervalSize,
+                                   SeedChainScratch& scratch);
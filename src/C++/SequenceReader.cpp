@@ -1,10 +1,10 @@
 // Author: Brett Bowman
 
-#include <fstream>
-#include <iostream>
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
 
 #include <seqan/sequence.h>
-#include <seqan/seq_io.h>
 
 #include "SequenceReader.hpp"
 
@@ -12,31 +12,405 @@ using namespace seqan;
 
 namespace srsli {
 
-    // Open file and create RecordReader.
-    SequenceReader::SequenceReader(const std::string& filename)
-            : Filename( filename )
-            , Stream( Filename.c_str() )
-            , CurrentIdx( 0 )
+    // BAM packs two bases to a byte, as indices into "=ACMGRSVTWYHKDBN";
+    //    anything ambiguous becomes an N
+    static const char BamBases[16] = {
+        'N', 'A', 'C', 'N', 'G', 'N', 'N', 'N', 'T', 'N', 'N', 'N', 'N', 'N', 'N', 'N'
+    };
+
+    // The size of a fixed-size BAM tag value, or 0 for any other type
+    static size_t BamTagValueSize(const char type)
+    {
+        switch (type) {
+            case 'A': case 'c': case 'C': return 1;
+            case 's': case 'S': return 2;
+            case 'i': case 'I': case 'f': return 4;
+            default: return 0;
+        }
+    }
+
+    // An integer BAM tag value, or -1 for a tag of any other type
+    static int64_t BamTagInteger(const char type, const uint8_t* value)
+    {
+        int8_t i8; int16_t i16; uint16_t u16; int32_t i32; uint32_t u32;
+        switch (type) {
+            case 'c': memcpy(&i8, value, 1); return i8;
+            case 'C': return value[0];
+            case 's': memcpy(&i16, value, 2); return i16;
+            case 'S': memcpy(&u16, value, 2); return u16;
+            case 'i': memcpy(&i32, value, 4); return i32;
+            case 'I': memcpy(&u32, value, 4); return u32;
+            default: return -1;
+        }
+    }
+
+    std::shared_ptr<SequenceBatch> SequenceReader::NextBatch()
+    {
+        std::unique_ptr<SequenceBatch> batch;
+        {
+            std::unique_lock<std::mutex> guard(stateLock);
+            batchReady.wait(guard, [&]{ return !ready.empty() || finished; });
+            if (ready.empty())
+            {
+                if (firstError)
+                    std::rethrow_exception(firstError);
+                return nullptr;
+            }
+            batch = std::move(ready.front());
+            ready.pop_front();
+        }
+        batchTaken.notify_one();
+        return std::shared_ptr<SequenceBatch>(batch.release(),
+                                              [this](SequenceBatch* used) { Recycle(used); });
+    }
+
+    const std::string& SequenceReader::ReadGroupHeader() const
+    {
+        return readGroupHeader;
+    }
+
+    // Private functions
+    bool SequenceReader::NextLine(std::string& line)
+    {
+        line.clear();
+        bool found = false;
+        while (true)
+        {
+            if (chunkPos == chunk.size())
+            {
+                chunkPos = 0;
+                if (!input.Read(chunk))
+                    break;
+            }
+            found = true;
+
+            const char* start = chunk.data() + chunkPos;
+            const size_t available = chunk.size() - chunkPos;
+            const char* end = (const char*)memchr(start, '\n', available);
+            if (end == NULL)
+            {
+                line.append(start, available);
+                chunkPos = chunk.size();
+                continue;
+            }
+            line.append(start, end - start);
+            chunkPos += end - start + 1;
+            break;
+        }
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.resize(line.size() - 1);
+        return found;
+    }
+
+    // Copy the next length bytes of the input, returning false if it had
+    //    already ended
+    bool SequenceReader::ReadBytes(char* buffer, const size_t length)
     {
-        if (!isGood(Stream))
+        size_t copied = 0;
+        while (copied < length)
         {
-            throw std::runtime_error("ERROR: Could not open the file.");
+            if (chunkPos == chunk.size())
+            {
+                chunkPos = 0;
+                if (!input.Read(chunk))
+                {
+                    if (copied == 0)
+                        return false;
+                    throw std::runtime_error("ERROR: The BAM query file is truncated");
+                }
+            }
+            size_t take = std::min(length - copied, chunk.size() - chunkPos);
+            memcpy(buffer + copied, chunk.data() + chunkPos, take);
+            copied += take;
+            chunkPos += take;
         }
+        return true;
+    }
+
+    int32_t SequenceReader::ReadInt32()
+    {
+        int32_t value;
+        if (!ReadBytes((char*)&value, sizeof(value)))
+            throw std::runtime_error("ERROR: The BAM query file is truncated");
+        return value;
+    }
+
+    // Skip the BAM header, keeping only its read groups
+    void SequenceReader::ReadBamHeader()
+    {
+        char magic[4];
+        ReadBytes(magic, sizeof(magic));
+        int32_t textLength = ReadInt32();
+        if (textLength < 0)
+            throw std::runtime_error("ERROR: Malformed BAM header in the query file");
+        std::string text(textLength, '\0');
+        if (textLength > 0)
+            ReadBytes(&text[0], textLength);
+
+        size_t lineStart = 0;
+        while (lineStart < text.size())
+        {
+            size_t lineEnd = std::min(text.find('\n', lineStart), text.size());
+            if (text.compare(lineStart, 4, "@RG\t") == 0)
+                readGroupHeader += text.substr(lineStart, lineEnd - lineStart) + "\n";
+            lineStart = lineEnd + 1;
+        }
+
+        // Unaligned BAMs shouldn't list any references, but skip any there are
+        int32_t numReferences = ReadInt32();
+        for (int32_t i = 0; i < numReferences; ++i)
+        {
+            int32_t nameLength = ReadInt32();
+            if (nameLength < 0)
+                throw std::runtime_error("ERROR: Malformed BAM header in the query file");
+            std::string name(nameLength, '\0');
+            if (nameLength > 0)
+                ReadBytes(&name[0], nameLength);
+            ReadInt32();
+        }
+    }
+
+    bool SequenceReader::ParseRecord(SequenceRecord& record)
+    {
+        return isBam ? ParseBamRecord(record) : ParseFastxRecord(record);
     }
 
-    bool SequenceReader::GetNext(std::pair<size_t, SequenceRecord>& idxAndRecord)
+    // Parse the next Fasta or Fastq record, whose sequence and qualities
+    //    may be wrapped over several lines.  Fasta records end at the next
+    //    header, which is held on to for the record after
+    bool SequenceReader::ParseFastxRecord(SequenceRecord& record)
     {
-        if (atEnd(Stream))
+        if (!haveHeader)
+            do {
+                if (!NextLine(header))
+                    return false;
+            } while (header.empty());
+        haveHeader = false;
+
+        assign(record.Id, header.c_str() + 1);
+        clear(record.ReadGroup);
+        record.Zmw = -1;
+        seqText.clear();
+        if (header[0] == '>')
+        {
+            while (NextLine(line))
+            {
+                if (!line.empty() && line[0] == '>')
+                {
+                    header.swap(line);
+                    haveHeader = true;
+                    break;
+                }
+                seqText += line;
+            }
+            assign(record.Seq, seqText.c_str());
+            clear(record.Qual);
+            return true;
+        }
+
+        if (header[0] == '@')
+        {
+            while (true)
+            {
+                if (!NextLine(line))
+                    throw std::runtime_error("ERROR: The query file ends part-way through a Fastq record");
+                if (!line.empty() && line[0] == '+')
+                    break;
+                seqText += line;
+            }
+            qualText.clear();
+            while (qualText.size() < seqText.size())
+            {
+                if (!NextLine(line))
+                    throw std::runtime_error("ERROR: The query file ends part-way through a Fastq record");
+                qualText += line;
+            }
+            if (qualText.size() != seqText.size())
+                throw std::runtime_error("ERROR: Fastq record with qualities and sequence of different lengths");
+            assign(record.Seq, seqText.c_str());
+            assign(record.Qual, qualText.c_str());
+            return true;
+        }
+
+        throw std::runtime_error("ERROR: The query file is neither Fasta nor Fastq");
+    }
+
+    // Decode the next BAM record, unpacking its bases straight into the
+    //    record's sequence and keeping its RG and zm tags
+    bool SequenceReader::ParseBamRecord(SequenceRecord& record)
+    {
+        int32_t blockSize;
+        if (!ReadBytes((char*)&blockSize, sizeof(blockSize)))
             return false;
+        if (blockSize < 32)
+            throw std::runtime_error("ERROR: Malformed BAM record in the query file");
+        bamRecord.resize(blockSize);
+        if (!ReadBytes(&bamRecord[0], blockSize))
+            throw std::runtime_error("ERROR: The BAM query file is truncated");
 
-        size_t& idx = idxAndRecord.first;
-        SequenceRecord& rec = idxAndRecord.second;
+        const uint8_t* data = (const uint8_t*)bamRecord.data();
+        const uint8_t* end = data + blockSize;
+        uint8_t nameLength = data[8];
+        uint16_t numCigarOps;
+        int32_t seqLength;
+        memcpy(&numCigarOps, data + 12, sizeof(numCigarOps));
+        memcpy(&seqLength, data + 16, sizeof(seqLength));
 
-        if (readRecord(rec.Id, rec.Seq, rec.Qual, Stream) == 0)
+        const uint8_t* name = data + 32;
+        const uint8_t* seq = name + nameLength + 4 * (size_t)numCigarOps;
+        const uint8_t* qual = seq + (seqLength + 1) / 2;
+        const uint8_t* tags = qual + seqLength;
+        if (nameLength == 0 || seqLength < 0 || tags > end || name[nameLength - 1] != '\0')
+            throw std::runtime_error("ERROR: Malformed BAM record in the query file");
+
+        assign(record.Id, (const char*)name);
+        resize(record.Seq, seqLength);
+        for (int32_t i = 0; i < seqLength; ++i)
+            record.Seq[i] = BamBases[(seq[i >> 1] >> ((~i & 1) << 2)) & 0xF];
+        if (seqLength == 0 || qual[0] == 0xFF)
+            clear(record.Qual);
+        else
+        {
+            resize(record.Qual, seqLength);
+            for (int32_t i = 0; i < seqLength; ++i)
+                record.Qual[i] = (char)(qual[i] + 33);
+        }
+
+        clear(record.ReadGroup);
+        record.Zmw = -1;
+        while (tags + 3 <= end)
+        {
+            const char type = tags[2];
+            const uint8_t* value = tags + 3;
+            const uint8_t* next;
+            if (type == 'Z' || type == 'H')
+            {
+                const uint8_t* terminator = (const uint8_t*)memchr(value, '\0', end - value);
+                if (terminator == NULL)
+                    throw std::runtime_error("ERROR: Malformed BAM record in the query file");
+                if (tags[0] == 'R' && tags[1] == 'G')
+                    assign(record.ReadGroup, (const char*)value);
+                next = terminator + 1;
+            }
+            else if (type == 'B')
+            {
+                uint32_t count;
+                if (value + 5 > end || BamTagValueSize(value[0]) == 0)
+                    throw std::runtime_error("ERROR: Malformed BAM record in the query file");
+                memcpy(&count, value + 1, sizeof(count));
+                next = value + 5 + BamTagValueSize(value[0]) * (size_t)count;
+            }
+            else
+            {
+                if (BamTagValueSize(type) == 0)
+                    throw std::runtime_error("ERROR: Malformed BAM record in the query file");
+                if (tags[0] == 'z' && tags[1] == 'm')
+                    record.Zmw = BamTagInteger(type, value);
+                next = value + BamTagValueSize(type);
+            }
+            if (next > end)
+                throw std::runtime_error("ERROR: Malformed BAM record in the query file");
+            tags = next;
+        }
+        return true;
+    }
+
+    // Fill a new or recycled batch, writing over the records already in it
+    void SequenceReader::FillBatch(SequenceBatch& batch)
+    {
+        size_t count = 0;
+        while (count < batchSize)
+        {
+            if (count == batch.size())
+                batch.resize(count + 1);
+            if (!ParseRecord(batch[count].second))
+                break;
+            batch[count].first = nextIdx++;
+            ++count;
+        }
+        batch.resize(count);
+    }
+
+    void SequenceReader::ReaderLoop()
+    {
+        try {
+            while (true)
+            {
+                std::unique_ptr<SequenceBatch> batch;
+                {
+                    std::unique_lock<std::mutex> guard(stateLock);
+                    batchTaken.wait(guard, [&]{ return stopping || ready.size() < maxQueued; });
+                    if (stopping)
+                        return;
+                    if (!spare.empty())
+                    {
+                        batch = std::move(spare.back());
+                        spare.pop_back();
+                    }
+                }
+                if (!batch)
+                    batch.reset(new SequenceBatch());
+                FillBatch(*batch);
+
+                std::lock_guard<std::mutex> guard(stateLock);
+                if (batch->empty())
+                {
+                    finished = true;
+                    batchReady.notify_all();
+                    return;
+                }
+                ready.push_back(std::move(batch));
+                batchReady.notify_one();
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(stateLock);
+            firstError = std::current_exception();
+            finished = true;
+            batchReady.notify_all();
+        }
+    }
+
+    // Keep enough used batches to refill, and free the rest
+    void SequenceReader::Recycle(SequenceBatch* batch)
+    {
+        std::unique_ptr<SequenceBatch> used(batch);
+        std::lock_guard<std::mutex> guard(stateLock);
+        if (spare.size() < maxQueued)
+            spare.push_back(std::move(used));
+    }
+
+    // Open the file and start reading ahead
+    SequenceReader::SequenceReader(const std::string& filename,
+                                   const size_t batchSize_,
+                                   const size_t maxQueued_,
+                                   const size_t decompressThreads)
+            : batchSize( std::max<size_t>(batchSize_, 1) )
+            , maxQueued( std::max<size_t>(maxQueued_, 1) )
+            , input( filename, decompressThreads )
+            , chunkPos( 0 )
+            , haveHeader( false )
+            , isBam( false )
+            , nextIdx( 0 )
+            , finished( false )
+            , stopping( false )
+    {
+        // Read a BAM's header up-front, so its read groups are known before
+        //    any output is written
+        if (input.Read(chunk) && chunk.compare(0, 4, "BAM\1", 4) == 0)
+        {
+            isBam = true;
+            ReadBamHeader();
+        }
+        reader = std::thread(&SequenceReader::ReaderLoop, this);
+    }
+
+    SequenceReader::~SequenceReader()
+    {
         {
-            idx = CurrentIdx++;
-            return true;  // Could not record from file.
+            std::lock_guard<std::mutex> guard(stateLock);
+            stopping = true;
         }
-        return false;
+        batchTaken.notify_all();
+        reader.join();
     }
-}
\ No newline at end of file
+}
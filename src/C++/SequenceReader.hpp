@@ -2,34 +2,102 @@
 
 #pragma once
 
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include <seqan/sequence.h>
-#include <seqan/seq_io.h>
+
+#include "ChunkReader.hpp"
 
 using namespace seqan;
 
 namespace srsli {
 
-    /// A struct for storing records as they are read
+    /// A struct for storing records as they are read.  Records from BAM
+    ///   also keep their read group and ZMW, when tagged, to pass through
+    ///   to the output
     struct SequenceRecord {
         CharString Id;
         Dna5String Seq;
         CharString Qual;
+        CharString ReadGroup;
+        int64_t Zmw;
     };
 
-    /// brief A pairwise alignment
+    /// A batch of records, each with its index in the input
+    typedef std::vector<std::pair<size_t, SequenceRecord>> SequenceBatch;
+
+    /// Reads Fasta, Fastq or unaligned BAM records, plain or gzipped, on a
+    ///   background thread that keeps up to maxQueued batches parsed ahead
+    ///   of the mapper.  A batch goes back to the reader once its last owner
+    ///   lets go of it, to be refilled in place so its records' storage gets
+    ///   reused; the reader must therefore outlive every batch it hands out
     class SequenceReader {
 
     private:
-        std::string Filename;
-        SequenceRecord Record;
-        SequenceStream Stream;
-        size_t CurrentIdx;
+        const size_t batchSize;
+        const size_t maxQueued;
+        ChunkReader input;
+
+        // Parsing state, only touched by the background thread once started
+        std::string chunk;
+        size_t chunkPos;
+        std::string header;
+        bool haveHeader;
+        std::string line;
+        std::string seqText;
+        std::string qualText;
+        bool isBam;
+        std::string bamRecord;
+        std::string readGroupHeader;
+        size_t nextIdx;
+
+        std::mutex stateLock;
+        std::condition_variable batchReady;
+        std::condition_variable batchTaken;
+        std::deque<std::unique_ptr<SequenceBatch>> ready;
+        std::vector<std::unique_ptr<SequenceBatch>> spare;
+        bool finished;
+        bool stopping;
+        std::exception_ptr firstError;
+        std::thread reader;
+
+    private:
+        bool NextLine(std::string& line);
+        bool ReadBytes(char* buffer, const size_t length);
+        int32_t ReadInt32();
+        void ReadBamHeader();
+        bool ParseRecord(SequenceRecord& record);
+        bool ParseFastxRecord(SequenceRecord& record);
+        bool ParseBamRecord(SequenceRecord& record);
+        void FillBatch(SequenceBatch& batch);
+        void ReaderLoop();
+        void Recycle(SequenceBatch* batch);
 
     public:
-        // Read the next record in the stream, if any
-        bool GetNext(std::pair<size_t, SequenceRecord>&);
+        // The next batch of up to batchSize records in input order, or null
+        //    once they're all read, re-throwing any error met reading them
+        std::shared_ptr<SequenceBatch> NextBatch();
+
+        // The @RG lines of a BAM input's header, for the output's header
+        const std::string& ReadGroupHeader() const;
 
     public:
-        SequenceReader(const std::string& filename);
+        SequenceReader(const std::string& filename,
+                       const size_t batchSize,
+                       const size_t maxQueued,
+                       const size_t decompressThreads);
+        ~SequenceReader();
+
+        SequenceReader(const SequenceReader&) = delete;
+        SequenceReader& operator=(const SequenceReader&) = delete;
     };
-}
\ No newline at end of file
+}
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <utility>
 #include <vector>
 #include <algorithm>
 
@@ -12,8 +16,13 @@
 #include "config/SeqAnConfig.hpp"
 #include "config/Types.hpp"
 #include "utils/Align.cpp"
+#include "utils/BandedAlign.cpp"
+#include "utils/BatchAlign.cpp"
+#include "utils/EditDistance.cpp"
 #include "utils/RegionT.cpp"
 #include "ReferenceSet.hpp"
+#include "SequenceReader.hpp"
+#include "ThreadPool.hpp"
 #include "AlignmentRecord.cpp"
 
 using namespace seqan;
@@ -25,7 +34,7 @@ region_t ChoseAlignmentRegion(const TSeedChain& chain,
                               const int queryLength,
                               const int refLength,
                               const int maxChainBuffer,
-                              const float netMaxIndels = 1.3)
+                              const float netMaxIndels)
 {
     region_t alignmentRegion;
     int querySeedStart = beginPositionH(chain);
@@ -47,10 +56,13 @@ region_t ChoseAlignmentRegion(const TSeedChain& chain,
     return alignmentRegion;
 }
 
-String<TSeed> ShiftSeedString(const TSeedChain& string,
-                              const region_t alignmentRegion)
+// Copy a chain into output with its seeds moved into the coordinates of
+//    the alignment region, reusing output's storage
+void ShiftSeedString(TSeedChain& output,
+                     const TSeedChain& string,
+                     const region_t alignmentRegion)
 {
-    String<TSeed> output;
+    clear(output);
     for (size_t i = 0; i < length(string); ++i)
     {   
         TSeed newSeed(beginPositionH(string[i]) - alignmentRegion.queryStart,
@@ -59,7 +71,385 @@ String<TSeed> ShiftSeedString(const TSeedChain& string,
                       endPositionV(string[i])   - alignmentRegion.refStart);
         appendValue(output, newSeed);
     }
-    return output;
+}
+
+// Copy the query and reference of a region out as ordinal values for the
+//    SIMD aligners
+void RegionToOrdinals(std::vector<uint8_t>& query,
+                      std::vector<uint8_t>& ref,
+                      const Dna5String& querySeq,
+                      const ReferenceView& refSeq,
+                      const region_t& alignmentRegion)
+{
+    query.resize(alignmentRegion.queryEnd - alignmentRegion.queryStart);
+    for (size_t i = 0; i < query.size(); ++i)
+        query[i] = ordValue(querySeq[alignmentRegion.queryStart + i]);
+    ref.resize(alignmentRegion.refEnd - alignmentRegion.refStart);
+    refSeq.CopyOrdValues(ref.data(), alignmentRegion.refStart, alignmentRegion.refEnd);
+}
+
+// Run-length encode a list of alignment operations, telling matches from
+//    mismatches by the bases they pair
+void AlignOpsToCigar(std::vector<CigarUnit>& cigar,
+                     const std::vector<uint8_t>& ops,
+                     const uint8_t* query,
+                     const uint8_t* ref)
+{
+    cigar.clear();
+    size_t queryPos = 0, refPos = 0;
+    for (size_t i = 0; i < ops.size(); ++i)
+    {
+        if (ops[i] == BandedAlignInsertion) {
+            AppendCigar(cigar, CigarInsertion, 1);
+            ++queryPos;
+        } else if (ops[i] == BandedAlignDeletion) {
+            AppendCigar(cigar, CigarDeletion, 1);
+            ++refPos;
+        } else {
+            AppendCigar(cigar, (query[queryPos] == ref[refPos]) ? CigarMatch : CigarMismatch, 1);
+            ++queryPos;
+            ++refPos;
+        }
+    }
+}
+
+// Append the result of one BandedAlign call to a list of operations,
+//    reversing those of an alignment made on reversed sequences
+void AppendAlignOps(std::vector<uint8_t>& ops,
+                    const std::vector<uint8_t>& pieceOps,
+                    const bool reversed)
+{
+    if (reversed)
+        ops.insert(ops.end(), pieceOps.rbegin(), pieceOps.rend());
+    else
+        ops.insert(ops.end(), pieceOps.begin(), pieceOps.end());
+}
+
+// One piece of a chain alignment being assembled by BatchRefChainsToAlignments:
+//    either a queued gap-fill problem, queued on reversed sequences for the
+//    extension back from the first seed, or the exact match of a seed
+struct ChainPiece {
+    size_t problem;
+    bool reversed;
+    size_t seedLength;
+    long seedScore;
+};
+
+// Working space for aligning chains, kept by each worker and reused from one
+//    chain and query to the next, so that the aligners only allocate while
+//    their buffers are still growing
+struct ChainAlignScratch {
+    TSeedChain shiftedChain;
+    std::vector<uint8_t> query;
+    std::vector<uint8_t> ref;
+    std::vector<uint8_t> leadQuery;
+    std::vector<uint8_t> leadRef;
+    std::vector<uint8_t> ops;
+    std::vector<std::pair<long, long>> path;
+    std::vector<CigarUnit> cigar;
+
+    // The pieces of a chain alignment, made apart and then joined: the lead,
+    //    each block of the core, and the tail
+    std::vector<std::pair<size_t, size_t>> blockEnds;
+    std::vector<std::vector<std::pair<long, long>>> blockPaths;
+    std::vector<std::vector<uint8_t>> pieceOps;
+    std::vector<long> pieceScores;
+    std::vector<BandedAlignBuffers> pieceBuffers;
+
+    // The candidates of a batch, or of a query aligned in parallel, being
+    //    assembled, and which of the latter were accepted
+    std::vector<AlignmentRecord> records;
+    std::vector<uint8_t> accepted;
+    std::vector<size_t> recordQuery;
+    std::vector<uint8_t> regionBases;
+    std::vector<size_t> recordBases;
+    std::vector<size_t> pieceStarts;
+    std::vector<ChainPiece> pieces;
+};
+
+// The working space of one candidate aligned as a task of its own
+struct CandidateAlignScratch {
+    ChainAlignScratch align;
+    BandedAlignBuffers alignBuffers;
+    BandedEditBuffers editBuffers;
+};
+
+// How to align long queries: their chains' cores are cut into blocks
+//    whatever the number of workers, so the output never depends on it, and
+//    with a pool the candidates and blocks are spread over its workers
+struct IntraReadParallel {
+    ThreadPool* pool;       // Null to align every query on its own worker
+    size_t minQueryLength;  // Shorter queries align in one block, on their own worker
+    size_t blockLength;     // Least query bases per block of a chain's core
+};
+
+// The least query bases per block of a query's chains, from its length alone
+size_t ChainBlockLength(const Dna5String& querySeq,
+                        const IntraReadParallel& parallel)
+{
+    return (length(querySeq) >= parallel.minQueryLength) ? parallel.blockLength : SIZE_MAX;
+}
+
+// Align a record's region with the vectorized banded aligner, and give the
+//    record the result.  Between its first and last seeds the alignment is global,
+//    with the band following the seeds and widening around gaps whose
+//    lengths differ; beyond them it extends out in both directions until its
+//    score falls params.xDrop below the best seen, leaving the rest of the
+//    region as end gaps for clipping.  The core is cut at the ends of seeds
+//    into blocks of at least blockLength query bases, which align
+//    independently since each starts and ends on a seed.  Given a pool, the
+//    extensions and blocks all align side by side as tasks on it, the first
+//    in buffers and the rest in the scratch's
+long SimdChainAlignment(AlignmentRecord& alnRec,
+                        const Dna5String& querySeq,
+                        const ReferenceView& refSeq,
+                        const TSeedChain& shiftedChain,
+                        const BandedAlignParams& params,
+                        BandedAlignBuffers& buffers,
+                        ChainAlignScratch& scratch,
+                        ThreadPool* pool = NULL,
+                        const size_t blockLength = SIZE_MAX)
+{
+    std::vector<uint8_t>& query = scratch.query;
+    std::vector<uint8_t>& ref = scratch.ref;
+    RegionToOrdinals(query, ref, querySeq, refSeq, alnRec.AlignmentRegion);
+    const size_t beginH = beginPositionH(shiftedChain);
+    const size_t beginV = beginPositionV(shiftedChain);
+    const size_t endH = endPositionH(shiftedChain);
+    const size_t endV = endPositionV(shiftedChain);
+
+    std::vector<std::pair<long, long>>& path = scratch.path;
+    path.clear();
+    for (size_t i = 0; i < length(shiftedChain); ++i)
+    {
+        path.push_back(std::make_pair((long)(beginPositionH(shiftedChain[i]) - beginH),
+                                      (long)(beginPositionV(shiftedChain[i]) - beginV)));
+        path.push_back(std::make_pair((long)(endPositionH(shiftedChain[i]) - beginH),
+                                      (long)(endPositionV(shiftedChain[i]) - beginV)));
+    }
+
+    // Only cut where a seed ends before the next one starts, and at least
+    //    blockLength query bases past the last cut
+    std::vector<std::pair<size_t, size_t>>& blockEnds = scratch.blockEnds;
+    blockEnds.clear();
+    blockEnds.push_back(std::make_pair(beginH, beginV));
+    for (size_t i = 0; i + 1 < length(shiftedChain); ++i)
+    {
+        size_t cutH = endPositionH(shiftedChain[i]);
+        size_t cutV = endPositionV(shiftedChain[i]);
+        if (cutH > blockEnds.back().first && cutV > blockEnds.back().second &&
+                cutH - blockEnds.back().first >= blockLength &&
+                cutH <= beginPositionH(shiftedChain[i+1]) &&
+                cutV <= beginPositionV(shiftedChain[i+1]))
+            blockEnds.push_back(std::make_pair(cutH, cutV));
+    }
+    blockEnds.push_back(std::make_pair(endH, endV));
+
+    const size_t numPieces = blockEnds.size() + 1;
+    if (scratch.pieceOps.size() < numPieces)
+    {
+        scratch.pieceOps.resize(numPieces);
+        scratch.blockPaths.resize(numPieces);
+    }
+    scratch.pieceScores.resize(numPieces);
+
+    BandedAlignParams extendParams = params;
+    extendParams.end = BandedAlignExtend;
+    BandedAlignParams coreParams = params;
+    coreParams.end = BandedAlignGlobal;
+    const std::vector<std::pair<long, long>> noPath;
+
+    std::vector<uint8_t>& leadQuery = scratch.leadQuery;
+    std::vector<uint8_t>& leadRef = scratch.leadRef;
+    leadQuery.assign(query.rend() - beginH, query.rend());
+    leadRef.assign(ref.rend() - beginV, ref.rend());
+
+    // Piece 0 is the lead, aligned on the reversed sequences, the last the
+    //    tail, and those between the blocks of the core, each along the part
+    //    of the path inside it
+    auto alignPiece = [&](const size_t p, BandedAlignBuffers& pieceBuffers) {
+        std::vector<uint8_t>& pieceOps = scratch.pieceOps[p];
+        long& pieceScore = scratch.pieceScores[p];
+        if (p == 0)
+        {
+            pieceScore = BandedAlign(pieceBuffers, leadQuery.data(), leadQuery.size(),
+                                     leadRef.data(), leadRef.size(), noPath, extendParams, pieceOps);
+        }
+        else if (p + 1 == numPieces)
+        {
+            pieceScore = BandedAlign(pieceBuffers, query.data() + endH, query.size() - endH,
+                                     ref.data() + endV, ref.size() - endV, noPath, extendParams, pieceOps);
+        }
+        else
+        {
+            const std::pair<size_t, size_t>& from = blockEnds[p-1];
+            const std::pair<size_t, size_t>& to = blockEnds[p];
+            const long offsetH = from.first - beginH;
+            const long offsetV = from.second - beginV;
+            std::vector<std::pair<long, long>>& blockPath = scratch.blockPaths[p];
+            blockPath.clear();
+            for (size_t i = 0; i < path.size(); ++i)
+                if (path[i].first >= offsetH && path[i].second >= offsetV &&
+                        path[i].first <= offsetH + (long)(to.first - from.first) &&
+                        path[i].second <= offsetV + (long)(to.second - from.second))
+                    blockPath.push_back(std::make_pair(path[i].first - offsetH, path[i].second - offsetV));
+            pieceScore = BandedAlign(pieceBuffers, query.data() + from.first, to.first - from.first,
+                                     ref.data() + from.second, to.second - from.second,
+                                     blockPath, coreParams, pieceOps);
+        }
+    };
+
+    if (pool == NULL)
+    {
+        for (size_t p = 0; p < numPieces; ++p)
+            alignPiece(p, buffers);
+    }
+    else
+    {
+        if (scratch.pieceBuffers.size() < numPieces)
+            scratch.pieceBuffers.resize(numPieces);
+        TaskGroup pieces(*pool);
+        for (size_t p = 0; p < numPieces; ++p)
+            pieces.Run([&, p]() { alignPiece(p, (p == 0) ? buffers : scratch.pieceBuffers[p]); });
+        pieces.Wait();
+    }
+
+    std::vector<uint8_t>& ops = scratch.ops;
+    ops.clear();
+    long score = 0;
+    for (size_t p = 0; p < numPieces; ++p)
+    {
+        AppendAlignOps(ops, scratch.pieceOps[p], p == 0);
+        score += scratch.pieceScores[p];
+    }
+
+    AlignOpsToCigar(scratch.cigar, ops, query.data(), ref.data());
+    alnRec.SetCigar(scratch.cigar);
+    return score;
+}
+
+// Whether a chain can still align above minAccuracy, judged before any full
+//    DP from e, a lower bound on the edit distance of the chain's query span
+//    of m bases against the whole reference region.  Even with the flanks of
+//    the region outside the chain, f more bases, aligned without an edit,
+//    the alignment of the region can be at most (m + f) / (m + f + e)
+//    accurate, so a chain failing that can't pass before clipping.  Clipping
+//    drops poorly aligned ends and may still have lifted it above
+//    minAccuracy, which is why the prefilter is only run when asked for
+bool PassesEditPrefilter(BandedEditBuffers& buffers,
+                         ChainAlignScratch& scratch,
+                         const Dna5String& querySeq,
+                         const ReferenceView& refSeq,
+                         const TSeedChain& chain,
+                         const region_t& alignmentRegion,
+                         const float minAccuracy,
+                         const size_t bandWidth)
+{
+    size_t queryStart = beginPositionH(chain);
+    size_t queryEnd = endPositionH(chain);
+    std::vector<uint8_t>& query = scratch.query;
+    query.resize(queryEnd - queryStart);
+    for (size_t i = 0; i < query.size(); ++i)
+        query[i] = ordValue(querySeq[queryStart + i]);
+    std::vector<uint8_t>& ref = scratch.ref;
+    ref.resize(alignmentRegion.refEnd - alignmentRegion.refStart);
+    refSeq.CopyOrdValues(ref.data(), alignmentRegion.refStart, alignmentRegion.refEnd);
+
+    std::vector<std::pair<long, long>>& path = scratch.path;
+    path.clear();
+    for (size_t i = 0; i < length(chain); ++i)
+    {
+        path.push_back(std::make_pair((long)(beginPositionH(chain[i]) - queryStart),
+                                      (long)beginPositionV(chain[i]) - alignmentRegion.refStart));
+        path.push_back(std::make_pair((long)(endPositionH(chain[i]) - queryStart),
+                                      (long)endPositionV(chain[i]) - alignmentRegion.refStart));
+    }
+
+    long edits = BandedEditDistance(buffers, query.data(), query.size(),
+                                    ref.data(), ref.size(), path, bandWidth);
+    if (edits == LONG_MAX)
+        return true;
+    size_t flanks = (alignmentRegion.queryEnd - alignmentRegion.queryStart) - query.size();
+    return 100.0 * (query.size() + flanks) / (query.size() + flanks + edits) > minAccuracy;
+}
+
+// Align a long query's candidates as tasks on the pool, each of which also
+//    spreads its chain's blocks over it, so that one query alone can keep
+//    every worker busy.  The results are then taken in rank order up to the
+//    first candidate rejected, by the prefilter or for falling below
+//    minAccuracy, just as RefChainsToAlignments takes them; candidates ranked
+//    below one already rejected are skipped rather than aligned
+int ParallelRefChainsToAlignments(std::vector<AlignmentRecord>& results,
+                                  const Dna5String& querySeq,
+                                  const ReferenceSet& refSet,
+                                  const std::vector<ReferencedSeedChain>& refChains,
+                                  const size_t maxAligns,
+                                  const float minAccuracy,
+                                  const int maxChainBuffer,
+                                  const float maxNetIndelRate,
+                                  const BandedAlignParams& alignParams,
+                                  const bool prefilter,
+                                  const IntraReadParallel& parallel,
+                                  ChainAlignScratch& scratch,
+                                  std::vector<CandidateAlignScratch>& candidateScratch)
+{
+    std::vector<AlignmentRecord>& records = scratch.records;
+    std::vector<uint8_t>& accepted = scratch.accepted;
+    records.clear();
+    accepted.assign(maxAligns, 0);
+    if (candidateScratch.size() < maxAligns)
+        candidateScratch.resize(maxAligns);
+
+    for (size_t i = 0; i < maxAligns; ++i)
+    {
+        const ReferenceRecord& refRec = refSet.Records[refChains[i].referenceIndex];
+        region_t alignmentRegion = ChoseAlignmentRegion(refChains[i].chain,
+                                                        length(querySeq),
+                                                        refRec.seq.Length(),
+                                                        maxChainBuffer,
+                                                        maxNetIndelRate);
+        records.push_back(AlignmentRecord(length(querySeq), refRec.seq.Length(),
+                                          refChains[i].referenceIndex, alignmentRegion));
+    }
+
+    std::atomic<size_t> firstRejected(maxAligns);
+    TaskGroup candidates(*parallel.pool);
+    for (size_t i = 0; i < maxAligns; ++i)
+    {
+        candidates.Run([&, i]() {
+            if (i > firstRejected.load())
+                return;
+
+            const ReferencedSeedChain& refChain = refChains[i];
+            const ReferenceRecord& refRec = refSet.Records[refChain.referenceIndex];
+            CandidateAlignScratch& own = candidateScratch[i];
+            AlignmentRecord& alnRec = records[i];
+            bool passes = !prefilter ||
+                          PassesEditPrefilter(own.editBuffers, own.align, querySeq, refRec.seq,
+                                              refChain.chain, alnRec.AlignmentRegion, minAccuracy,
+                                              alignParams.bandWidth);
+            if (passes)
+            {
+                ShiftSeedString(own.align.shiftedChain, refChain.chain, alnRec.AlignmentRegion);
+                alnRec.Score = SimdChainAlignment(alnRec, querySeq, refRec.seq, own.align.shiftedChain,
+                                                  alignParams, own.alignBuffers, own.align,
+                                                  parallel.pool, ChainBlockLength(querySeq, parallel));
+                passes = alnRec.Accuracy() > minAccuracy;
+            }
+
+            if (passes) {
+                accepted[i] = 1;
+            } else {
+                size_t seen = firstRejected.load();
+                while (i < seen && !firstRejected.compare_exchange_weak(seen, i)) {}
+            }
+        });
+    }
+    candidates.Wait();
+
+    for (size_t i = 0; i < maxAligns && accepted[i]; ++i)
+        results.push_back(std::move(records[i]));
+    return 0;
 }
 
 //TODO: Why isn't the global align config working?
@@ -72,41 +462,236 @@ int RefChainsToAlignments(std::vector<AlignmentRecord>& results,
                           const size_t maxAligns,
                           const float minAccuracy,
                           const int maxChainBuffer,
-                          const int alignmentAnchorSize)
+                          const float maxNetIndelRate,
+                          const int alignmentAnchorSize,
+                          const std::string& aligner,
+                          const BandedAlignParams& alignParams,
+                          const bool prefilter,
+                          BandedAlignBuffers& alignBuffers,
+                          BandedEditBuffers& editBuffers,
+                          ChainAlignScratch& scratch,
+                          const IntraReadParallel& parallel,
+                          std::vector<CandidateAlignScratch>& candidateScratch)
 {
+    // Long queries spread their candidates over the pool instead
+    if (parallel.pool != NULL && aligner == "simd" && length(querySeq) >= parallel.minQueryLength)
+        return ParallelRefChainsToAlignments(results, querySeq, refSet, refChains, maxAligns,
+                                             minAccuracy, maxChainBuffer, maxNetIndelRate,
+                                             alignParams, prefilter, parallel, scratch,
+                                             candidateScratch);
+
     AlignConfig<false, false, true, true> globalConfig;
-    ReferencedSeedChain refChain;
-    ReferenceRecord refRec;
-    TDna* refSeqPtr;
-    TSeedChain* seedChain;
+    TSeedChain& shiftedChain = scratch.shiftedChain;
 
     for (size_t i = 0; i < maxAligns; ++i)
     {
-        refChain = refChains[i];
-        size_t refIdx = refChain.referenceIndex;
-        seedChain = &refChain.chain;
-        refRec = refSet.Records[refIdx];
-        refSeqPtr = refRec.seq;
+        size_t refIdx = refChains[i].referenceIndex;
+        const TSeedChain* seedChain = &refChains[i].chain;
+        const ReferenceRecord& refRec = refSet.Records[refIdx];
 
         region_t alignmentRegion = ChoseAlignmentRegion(*seedChain, 
                                                         length(querySeq), 
-                                                        length(*refSeqPtr), 
-                                                        maxChainBuffer);
-        TSeedChain shiftedChain = ShiftSeedString(*seedChain, alignmentRegion);
+                                                        refRec.seq.Length(),
+                                                        maxChainBuffer,
+                                                        maxNetIndelRate);
 
-        // Create an AlignmentRecord from the sequences and the selected region
-        AlignmentRecord alnRec(querySeq, *refSeqPtr, alignmentRegion);
+        // Like a failed alignment, a chain failing the prefilter ends the search
+        if (prefilter && !PassesEditPrefilter(editBuffers, scratch, querySeq, refRec.seq, *seedChain,
+                                              alignmentRegion, minAccuracy, alignParams.bandWidth))
+            break;
+        ShiftSeedString(shiftedChain, *seedChain, alignmentRegion);
+
+        // Create an AlignmentRecord for the selected region
+        AlignmentRecord alnRec(length(querySeq), refRec.seq.Length(), refIdx, alignmentRegion);
 
-        std::cout << "Starting alignment of sequences" << std::endl;
-        alnRec.Score = bandedChainAlignment(alnRec.Alignment, shiftedChain, scoring, globalConfig);
-        std::cout << "Finishing alignment of sequences" << std::endl;
-        std::cout << "Accuracy: " << alnRec.Accuracy() << std::endl;
+        if (aligner == "simd")
+        {
+            alnRec.Score = SimdChainAlignment(alnRec, querySeq, refRec.seq, shiftedChain,
+                                              alignParams, alignBuffers, scratch,
+                                              NULL, ChainBlockLength(querySeq, parallel));
+        }
+        else
+        {
+            // SeqAn needs the full alignment object, kept only until it is encoded
+            TAlign alignment;
+            TDna refInfix;
+            refRec.seq.Infix(refInfix, alignmentRegion.refStart, alignmentRegion.refEnd);
+            resize(rows(alignment), 2);
+            assignSource(row(alignment, 0), infix(querySeq, alignmentRegion.queryStart,
+                                                            alignmentRegion.queryEnd));
+            assignSource(row(alignment, 1), refInfix);
+            alnRec.Score = bandedChainAlignment(alignment, shiftedChain, scoring, globalConfig);
+
+            AlignToCigar(scratch.cigar, alignment);
+            alnRec.SetCigar(scratch.cigar);
+        }
 
         if (alnRec.Accuracy() > minAccuracy) {
-            results.push_back(alnRec);
+            results.push_back(std::move(alnRec));
         } else {
             break;
         }
     }
     return 0;
 }
+
+// Align the top chains of a whole batch of queries together.  Each chain is
+//    cut at its seeds into gap-fill problems: global alignments between
+//    consecutive seeds, and X-drop extensions out from its first and last
+//    seeds towards the ends of the region.  The problems of every candidate
+//    short enough for the lanes, in practice the gaps between seeds, are
+//    solved side by side in SIMD lanes; the extensions, which reach up to
+//    maxExtension bases, and any long gaps go one at a time through the
+//    banded kernel.  Then each alignment is stitched back
+//    together from its problems and its seeds.  As in RefChainsToAlignments,
+//    each query keeps its candidates up to the first below minAccuracy, or
+//    the first the prefilter rejects
+int BatchRefChainsToAlignments(std::vector<AlignmentRecord>& results,
+                               const std::vector<const SequenceRecord*>& queries,
+                               const ReferenceSet& refSet,
+                               const std::vector<std::vector<ReferencedSeedChain>>& refChains,
+                               const float minAccuracy,
+                               const int maxChainBuffer,
+                               const float maxNetIndelRate,
+                               const BandedAlignParams& params,
+                               const size_t maxLaneLength,
+                               const bool prefilter,
+                               GapFillBatch& batch,
+                               BandedEditBuffers& editBuffers,
+                               ChainAlignScratch& scratch)
+{
+    std::vector<AlignmentRecord>& records = scratch.records;
+    std::vector<size_t>& recordQuery = scratch.recordQuery;
+    std::vector<uint8_t>& regionBases = scratch.regionBases;
+    std::vector<size_t>& recordBases = scratch.recordBases;
+    std::vector<size_t>& pieceStarts = scratch.pieceStarts;
+    std::vector<ChainPiece>& pieces = scratch.pieces;
+    std::vector<uint8_t>& query = scratch.query;
+    std::vector<uint8_t>& ref = scratch.ref;
+    std::vector<uint8_t>& leadQuery = scratch.leadQuery;
+    std::vector<uint8_t>& leadRef = scratch.leadRef;
+    std::vector<uint8_t>& ops = scratch.ops;
+    TSeedChain& shiftedChain = scratch.shiftedChain;
+    records.clear();
+    recordQuery.clear();
+    regionBases.clear();
+    recordBases.clear();
+    pieceStarts.clear();
+    pieces.clear();
+    batch.Clear();
+
+    for (size_t q = 0; q < queries.size(); ++q)
+    {
+        for (size_t c = 0; c < refChains[q].size(); ++c)
+        {
+            const ReferencedSeedChain& refChain = refChains[q][c];
+            const ReferenceRecord& refRec = refSet.Records[refChain.referenceIndex];
+            region_t alignmentRegion = ChoseAlignmentRegion(refChain.chain,
+                                                            length(queries[q]->Seq),
+                                                            refRec.seq.Length(),
+                                                            maxChainBuffer,
+                                                            maxNetIndelRate);
+            if (prefilter && !PassesEditPrefilter(editBuffers, scratch, queries[q]->Seq, refRec.seq,
+                                                  refChain.chain, alignmentRegion, minAccuracy,
+                                                  params.bandWidth))
+                break;
+            ShiftSeedString(shiftedChain, refChain.chain, alignmentRegion);
+
+            records.push_back(AlignmentRecord(length(queries[q]->Seq), refRec.seq.Length(),
+                                              refChain.referenceIndex, alignmentRegion));
+            records.back().Query = queries[q];
+            recordQuery.push_back(q);
+            pieceStarts.push_back(pieces.size());
+            RegionToOrdinals(query, ref, queries[q]->Seq, refRec.seq, alignmentRegion);
+
+            // Keep the region's bases for building the CIGAR, rather than
+            //    unpacking the reference again
+            recordBases.push_back(regionBases.size());
+            regionBases.insert(regionBases.end(), query.begin(), query.end());
+            regionBases.insert(regionBases.end(), ref.begin(), ref.end());
+
+            size_t queryPos = beginPositionH(shiftedChain);
+            size_t refPos = beginPositionV(shiftedChain);
+            leadQuery.assign(query.rend() - queryPos, query.rend());
+            leadRef.assign(ref.rend() - refPos, ref.rend());
+            ChainPiece lead = { batch.Add(leadQuery.data(), leadQuery.size(),
+                                          leadRef.data(), leadRef.size(), true), true, 0, 0 };
+            pieces.push_back(lead);
+            for (size_t s = 0; s < length(shiftedChain); ++s)
+            {
+                // Trim anything overlapping the previous seed off this one's start
+                size_t beginH = beginPositionH(shiftedChain[s]);
+                size_t beginV = beginPositionV(shiftedChain[s]);
+                size_t seedLength = std::min(endPositionH(shiftedChain[s]) - beginH,
+                                             endPositionV(shiftedChain[s]) - beginV);
+                size_t trim = std::max(queryPos - std::min(queryPos, beginH),
+                                       refPos - std::min(refPos, beginV));
+                if (seedLength <= trim)
+                    continue;
+                beginH += trim;
+                beginV += trim;
+                seedLength -= trim;
+
+                if (s > 0)
+                {
+                    ChainPiece gapFill = { batch.Add(query.data() + queryPos, beginH - queryPos,
+                                                     ref.data() + refPos, beginV - refPos, false),
+                                           false, 0, 0 };
+                    pieces.push_back(gapFill);
+                }
+                ChainPiece seed = { SIZE_MAX, false, seedLength, 0 };
+                for (size_t k = 0; k < seedLength; ++k)
+                    seed.seedScore += (query[beginH + k] == ref[beginV + k]) ? params.match : params.mismatch;
+                pieces.push_back(seed);
+                queryPos = beginH + seedLength;
+                refPos = beginV + seedLength;
+            }
+            ChainPiece tail = { batch.Add(query.data() + queryPos, query.size() - queryPos,
+                                          ref.data() + refPos, ref.size() - refPos, true), false, 0, 0 };
+            pieces.push_back(tail);
+        }
+    }
+    pieceStarts.push_back(pieces.size());
+
+    SolveGapFills(batch, params, maxLaneLength);
+
+    size_t failedQuery = SIZE_MAX;
+    for (size_t r = 0; r < records.size(); ++r)
+    {
+        if (recordQuery[r] == failedQuery)
+            continue;
+
+        AlignmentRecord& alnRec = records[r];
+        alnRec.Score = 0;
+        ops.clear();
+        for (size_t p = pieceStarts[r]; p < pieceStarts[r+1]; ++p)
+        {
+            const ChainPiece& piece = pieces[p];
+            if (piece.problem == SIZE_MAX)
+            {
+                ops.insert(ops.end(), piece.seedLength, (uint8_t)BandedAlignMatch);
+                alnRec.Score += piece.seedScore;
+                continue;
+            }
+            const GapFillProblem& problem = batch.problems[piece.problem];
+            size_t opsStart = ops.size();
+            ops.insert(ops.end(), batch.ops.begin() + problem.opsOffset,
+                       batch.ops.begin() + problem.opsOffset + problem.opsLength);
+            if (piece.reversed)
+                std::reverse(ops.begin() + opsStart, ops.end());
+            alnRec.Score += problem.score;
+        }
+        const uint8_t* regionQuery = regionBases.data() + recordBases[r];
+        const region_t& region = alnRec.AlignmentRegion;
+        AlignOpsToCigar(scratch.cigar, ops, regionQuery,
+                        regionQuery + (region.queryEnd - region.queryStart));
+        alnRec.SetCigar(scratch.cigar);
+
+        if (alnRec.Accuracy() > minAccuracy) {
+            results.push_back(std::move(alnRec));
+        } else {
+            failedQuery = recordQuery[r];
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,226 @@
+// Author: Brett Bowman
+
+#include <algorithm>
+
+#include "ThreadPool.hpp"
+
+namespace srsli {
+
+    // Each worker remembers which pool it belongs to and its slot in it
+    static thread_local const ThreadPool* currentPool = nullptr;
+    static thread_local int currentWorkerIdx = -1;
+
+    void ThreadPool::Submit(Task task)
+    {
+        int self = CurrentWorker();
+        size_t target;
+
+        // Count the task under the state lock so a worker that is about
+        //    to sleep can't miss the wake-up
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            ++pending;
+            ++queued;
+            target = (self >= 0) ? self : nextQueue++ % queues.size();
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(queues[target]->lock);
+            queues[target]->tasks.push_back(std::move(task));
+        }
+        workAvailable.notify_one();
+    }
+
+    void ThreadPool::Wait(const size_t maxPending)
+    {
+        std::unique_lock<std::mutex> guard(stateLock);
+        workFinished.wait(guard, [&]{ return pending <= maxPending; });
+
+        if (firstError)
+        {
+            std::exception_ptr error = firstError;
+            firstError = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    int ThreadPool::CurrentWorker() const
+    {
+        return (currentPool == this) ? currentWorkerIdx : -1;
+    }
+
+    size_t ThreadPool::Size() const
+    {
+        return workers.size();
+    }
+
+    // Private functions
+    bool ThreadPool::TryPop(const size_t workerIdx, Task& task)
+    {
+        // Newest task from our own deque first, for cache locality
+        {
+            WorkerQueue& own = *queues[workerIdx];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.tasks.empty())
+            {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                --queued;
+                return true;
+            }
+        }
+
+        // ... otherwise steal the oldest task from the next busy worker
+        for (size_t i = 1; i < queues.size(); ++i)
+        {
+            WorkerQueue& victim = *queues[(workerIdx + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                --queued;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void ThreadPool::RunTask(Task& task)
+    {
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(stateLock);
+            if (!firstError)
+                firstError = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            --pending;
+        }
+        workFinished.notify_all();
+    }
+
+    void ThreadPool::WorkerLoop(const size_t workerIdx)
+    {
+        currentPool = this;
+        currentWorkerIdx = workerIdx;
+
+        Task task;
+        while (true)
+        {
+            if (TryPop(workerIdx, task))
+            {
+                RunTask(task);
+                task = nullptr;
+                continue;
+            }
+
+            std::unique_lock<std::mutex> guard(stateLock);
+            workAvailable.wait(guard, [&]{ return stopping || queued > 0; });
+            if (stopping && queued == 0)
+                return;
+        }
+    }
+
+    // Constructors
+    ThreadPool::ThreadPool(const size_t numThreads)
+            : queued( 0 )
+            , pending( 0 )
+            , nextQueue( 0 )
+            , stopping( false )
+    {
+        size_t nThreads = std::max(numThreads, size_t(1));
+        for (size_t i = 0; i < nThreads; ++i)
+            queues.emplace_back(new WorkerQueue());
+        for (size_t i = 0; i < nThreads; ++i)
+            workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
+    }
+
+    // TaskGroup
+    void TaskGroup::Run(ThreadPool::Task task)
+    {
+        {
+            std::lock_guard<std::mutex> guard(state->lock);
+            state->queued.push_back(std::move(task));
+            ++state->unfinished;
+        }
+
+        // Whoever gets to a task first runs it, so each one queued here
+        //    sends the pool a stand-in that runs the group's oldest task,
+        //    if the waiting thread hasn't already taken it
+        std::shared_ptr<State> shared = state;
+        pool.Submit([shared]() { RunOne(*shared); });
+    }
+
+    void TaskGroup::Wait()
+    {
+        while (RunOne(*state)) {}
+
+        std::unique_lock<std::mutex> guard(state->lock);
+        state->finished.wait(guard, [&]{ return state->unfinished == 0; });
+        if (state->firstError)
+        {
+            std::exception_ptr error = state->firstError;
+            state->firstError = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Private functions
+    bool TaskGroup::RunOne(State& state)
+    {
+        ThreadPool::Task task;
+        {
+            std::lock_guard<std::mutex> guard(state.lock);
+            if (state.queued.empty())
+                return false;
+            task = std::move(state.queued.front());
+            state.queued.pop_front();
+        }
+
+        std::exception_ptr error;
+        try {
+            task();
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> guard(state.lock);
+        if (error && !state.firstError)
+            state.firstError = error;
+        if (--state.unfinished == 0)
+            state.finished.notify_all();
+        return true;
+    }
+
+    // Constructors
+    TaskGroup::TaskGroup(ThreadPool& pool_)
+            : pool( pool_ )
+            , state( std::make_shared<State>() )
+    {
+        state->unfinished = 0;
+    }
+
+    // Tasks may refer to the caller's locals, so they must all be done
+    //    before the group goes out of scope, errors or not
+    TaskGroup::~TaskGroup()
+    {
+        try {
+            Wait();
+        } catch (...) {}
+    }
+}
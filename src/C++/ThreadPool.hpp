@@ -0,0 +1,106 @@
+// Author: Brett Bowman
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace srsli {
+
+    /// A fixed-size pool of worker threads with one task deque per worker.
+    ///   Workers pop their own newest tasks first and steal the oldest
+    ///   tasks from the other workers when their own deque runs dry
+    class ThreadPool {
+
+    public:
+        typedef std::function<void()> Task;
+
+    private:
+        struct WorkerQueue {
+            std::mutex lock;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::unique_ptr<WorkerQueue>> queues;
+        std::vector<std::thread> workers;
+
+        // Shared state for sleeping workers and waiting callers
+        std::mutex stateLock;
+        std::condition_variable workAvailable;
+        std::condition_variable workFinished;
+        std::atomic<size_t> queued;
+        size_t pending;
+        size_t nextQueue;
+        bool stopping;
+        std::exception_ptr firstError;
+
+    private:
+        bool TryPop(const size_t workerIdx, Task& task);
+        void RunTask(Task& task);
+        void WorkerLoop(const size_t workerIdx);
+
+    public:
+        // Queue a task, onto the caller's own deque if called from a worker
+        void Submit(Task task);
+
+        // Block until at most maxPending submitted tasks remain unfinished,
+        //    re-throwing the first exception raised by any task
+        void Wait(const size_t maxPending = 0);
+
+        // Index of the calling worker thread, or -1 for outside threads
+        int CurrentWorker() const;
+        size_t Size() const;
+
+    public:
+        ThreadPool(const size_t numThreads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+    };
+
+    /// A group of tasks run on a pool that can be waited for from inside
+    ///   one of the pool's own tasks.  The waiting thread runs the group's
+    ///   queued tasks itself while idle workers take the rest, so a worker
+    ///   never sits blocked on tasks that nobody has started
+    class TaskGroup {
+
+    private:
+        // Shared with the pool's copies of our tasks, which may outlive us
+        struct State {
+            std::mutex lock;
+            std::condition_variable finished;
+            std::deque<ThreadPool::Task> queued;
+            size_t unfinished;
+            std::exception_ptr firstError;
+        };
+
+        ThreadPool& pool;
+        std::shared_ptr<State> state;
+
+    private:
+        static bool RunOne(State& state);
+
+    public:
+        // Queue a task to run on the group's pool
+        void Run(ThreadPool::Task task);
+
+        // Block until every task run so far has finished, helping to run
+        //    them meanwhile, then re-throw the first exception any raised
+        void Wait();
+
+    public:
+        TaskGroup(ThreadPool& pool);
+        ~TaskGroup();
+
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+    };
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+#include "SeqAnConfig.hpp"
+
+// The seed sizes srsli is compiled for.  The minimizer index's 32-bit keys
+//    bound the largest size
+const int MinSeedSize = 8;
+const int MaxSeedSize = 16;
+
+// The largest seed size the dense q-gram index is built for: its directory
+//    of 4^13 + 1 entries already takes 512 MiB, and each size past it takes
+//    four times more.  Larger seeds need the sparse minimizer index
+const int MaxQGramSeedSize = 13;
+
+// Calls runner.template Run<FindSeedsConfig<K>>() for the K equal to the
+//    given seed size, so the whole pipeline is instantiated once per seed
+//    size and each instance keeps K as a compile-time constant
+template<int K>
+struct SeedSizeDispatch
+{
+    template<typename TRunner>
+    static int Run(const int seedSize, TRunner& runner)
+    {
+        if (seedSize == K)
+            return runner.template Run<FindSeedsConfig<K>>();
+        return SeedSizeDispatch<K+1>::Run(seedSize, runner);
+    }
+};
+
+template<>
+struct SeedSizeDispatch<MaxSeedSize + 1>
+{
+    template<typename TRunner>
+    static int Run(const int seedSize, TRunner&)
+    {
+        throw std::runtime_error("ERROR: Seed size " + std::to_string(seedSize) +
+                                 " is not supported, it must be from " +
+                                 std::to_string(MinSeedSize) + " to " +
+                                 std::to_string(MaxSeedSize));
+    }
+};
+
+template<typename TRunner>
+int DispatchSeedSize(const int seedSize, TRunner& runner)
+{
+    return SeedSizeDispatch<MinSeedSize>::Run(seedSize, runner);
+}
@@ -26,6 +26,7 @@ struct SeedConfig
 // Sequence-related types
 typedef Dna5String TDna;
 typedef Segment<const TDna> TSegment;
+typedef String<Dna, Packed<> > TPackedDna;  // 2-bit reference storage, Ns masked separately
 
 // Seed-related types
 typedef Seed<Simple> TSeed;
@@ -1,27 +1,91 @@
 #pragma once
 
+#include <stdint.h>
 #include <vector>
 
 #include "SeqAnConfig.hpp"
+#include "../ReferenceView.hpp"
 
 using namespace seqan;
 
-// These tuples represent a SeedSet and a Start and End index that
+// These tuples represent a seed bucket and a Start and End index that
 //   identify the seeds representing the 5' and 3' most seed anchors
 //   for a hit
 typedef std::tuple<size_t, size_t, size_t> SeedInterval;
 
+// The seeds of one query, bucketed by the reference records they hit.  Only
+//   records with hits get a bucket, in increasing record order, so the work
+//   per query scales with its hits rather than with the number of records.
+//   Buckets keep their storage from one query to the next
+template<typename TSeed>
+struct SeedBuckets {
+    std::vector<size_t> refs;
+    std::vector<std::vector<TSeed>> seeds;
+    size_t numBuckets;
+
+    SeedBuckets()
+        : numBuckets( 0 )
+    {}
+
+    size_t size() const { return numBuckets; }
+    size_t Reference(const size_t bucket) const { return refs[bucket]; }
+    const std::vector<TSeed>& Seeds(const size_t bucket) const { return seeds[bucket]; }
+
+    // Open an empty bucket for a record after any already added, good
+    //    until the next one is opened
+    std::vector<TSeed>& Add(const size_t ref)
+    {
+        if (numBuckets == seeds.size())
+        {
+            refs.push_back(ref);
+            seeds.push_back(std::vector<TSeed>());
+        }
+        refs[numBuckets] = ref;
+        seeds[numBuckets].clear();
+        return seeds[numBuckets++];
+    }
+
+    void Clear() { numBuckets = 0; }
+};
+
+// One exact match between a query and a reference record, before it is
+//   turned into a TSeed.  Seeding produces these with length equal to the
+//   seed size, and runs of them on one diagonal are then merged
+struct SeedHit {
+    uint32_t ref;
+    uint32_t queryPos;
+    uint32_t refPos;
+    uint32_t length;
+    float score;
+
+    SeedHit() {}
+
+    SeedHit(uint32_t r, uint32_t q, uint32_t p, uint32_t l, float s)
+        : ref( r )
+        , queryPos( q )
+        , refPos( p )
+        , length( l )
+        , score( s )
+    {}
+};
+
 // This struct represents an ordered vector of seeds and the index
-//   of the reference sequence from which it came
+//   of the reference sequence from which it came, plus the chain's
+//   score when it was found by the scored chainer
 struct ReferencedSeedChain {
     size_t referenceIndex;
     TSeedChain chain;
+    float score;
 
-    ReferencedSeedChain() {}
+    ReferencedSeedChain()
+        : referenceIndex( 0 )
+        , score( 0 )
+    {}
 
     ReferencedSeedChain(size_t i, TSeedChain c)
         : referenceIndex( i )
         , chain( c )
+        , score( 0 )
     {}
 };
 
@@ -34,16 +98,51 @@ struct region_t {
     int refEnd;
 };
 
+// The operations of a run-length encoded alignment, numbered as in the
+//   CIGAR strings of the BAM format
+enum CigarOp {
+    CigarInsertion = 1,
+    CigarDeletion = 2,
+    CigarSoftClip = 4,
+    CigarMatch = 7,
+    CigarMismatch = 8
+};
+
+// One run of a run-length encoded alignment, packed as in BAM: the run's
+//   length in the high 28 bits and its CigarOp in the low 4
+typedef uint32_t CigarUnit;
+
+// The columns of a clipped alignment by type, and the bases of each
+//   sequence left out of it at either end
+struct AlignmentStats {
+    size_t matches;
+    size_t mismatches;
+    size_t insertions;
+    size_t deletions;
+    size_t queryStartClip;
+    size_t queryEndClip;
+    size_t refStartClip;
+    size_t refEndClip;
+};
+
+// The id, strand and sequence view of one reference record.  Reverse
+//    records view the same packed bases as their forward record
 struct ReferenceRecord {
     CharString id;
-    TDna* seq;
+    srsli::ReferenceView seq;
     int orientation;
 
     ReferenceRecord() {}
 
-    ReferenceRecord(CharString i, TDna* s, int o)
+    ReferenceRecord(const CharString& i, const srsli::ReferenceView& s, int o)
         : id( i )
         , seq( s )
         , orientation( o )
     {}
+
+    // Records are only ever used in place, through references into their set
+    ReferenceRecord(ReferenceRecord&&) = default;
+    ReferenceRecord& operator=(ReferenceRecord&&) = default;
+    ReferenceRecord(const ReferenceRecord&) = delete;
+    ReferenceRecord& operator=(const ReferenceRecord&) = delete;
 };
@@ -3,6 +3,10 @@
 #include <math.h>
 #include <zlib.h>
 #include <stdio.h>
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <utility>
 #include <string>
 #include <vector>
@@ -12,21 +16,254 @@
 #include <seqan/index.h>
 
 #include "config/SeqAnConfig.hpp"
+#include "config/SeedSizeDispatch.hpp"
 #include "parameters/SrsliParameters.hpp"
+#include "parameters/IndexParameters.hpp"
 #include "Headers.cpp"
 #include "ReferenceSet.hpp"
+#include "QGramIndex.hpp"
+#include "MinimizerIndex.hpp"
 #include "AlignmentRecord.hpp"
 #include "SequenceReader.hpp"
-#include "FindSeeds.hpp"
-#include "SeedIntervals.cpp"
-#include "SparseAlignment.cpp"
+#include "ThreadPool.hpp"
+#include "ResultWriter.hpp"
+#include "SamSink.hpp"
+#include "MapQuery.cpp"
 
 using namespace seqan;
 using namespace srsli;
 
+// Summarize which reference Kmers the index masked, so the cutoffs can be
+//    tuned per genome, followed by the full frequency histogram if asked
+void ReportMasking(const QGramMaskStats& stats, const bool withHistogram)
+{
+    std::cerr << "Masked " << stats.maskedQGrams << " of " << stats.distinctQGrams
+              << " distinct q-grams (" << stats.maskedOccurrences << " of "
+              << stats.totalOccurrences << " occurrences)";
+    if (stats.maxOccurrences > 0 || stats.maskedQGrams > 0)
+        std::cerr << ", occurring over " << stats.maxOccurrences << " times";
+    std::cerr << std::endl;
+
+    if (!withHistogram)
+        return;
+    std::cerr << "Occurrences\tQ-grams" << std::endl;
+    for (size_t b = 0; b < QGramHistogramBins; ++b)
+        if (stats.histogram[b] > 0)
+            std::cerr << (uint64_t(1) << b) << "-" << (uint64_t(1) << (b + 1)) - 1
+                      << "\t" << stats.histogram[b] << std::endl;
+}
+
+// Open the output file and the sink writing the chosen format to it
+std::unique_ptr<ResultSink> OpenResultSink(FILE*& out,
+                                           const SrsliParameters& params,
+                                           const ReferenceSet& refSet,
+                                           const std::string& readGroupHeader)
+{
+    out = stdout;
+    if (params.outputFile != "-")
+    {
+        out = fopen(params.outputFile.c_str(), "wb");
+        if (out == NULL)
+            throw std::runtime_error("ERROR: Could not open the output file " + params.outputFile);
+    }
+
+    if (params.outputFormat == "sam")
+        return std::unique_ptr<ResultSink>(new SamSink(out, refSet, readGroupHeader));
+    if (params.outputFormat == "bam")
+        return std::unique_ptr<ResultSink>(new BamSink(out, refSet, readGroupHeader, params.numThreads));
+    return std::unique_ptr<ResultSink>(new M1Sink(out, M1Header, refSet));
+}
+
+// Builds and saves the index for one seed size, for 'srsli index'
+struct IndexRunner {
+    const IndexParameters& params;
+    const ReferenceSet& refSet;
+
+    IndexRunner(const IndexParameters& p, const ReferenceSet& r)
+        : params( p )
+        , refSet( r )
+    {}
+
+    template<typename TConfig>
+    int Run()
+    {
+        QGramIndex<TConfig> refSetIndex;
+        refSetIndex.Build(refSet, params.forwardIndex,
+                          params.maxOccurrences, params.maskFraction);
+        refSetIndex.Save(params.outputFile, refSet);
+
+        if (params.verbosity > 0)
+        {
+            std::cerr << "Wrote index of " << refSetIndex.SALength() << " q-grams to "
+                      << params.outputFile << std::endl;
+            ReportMasking(refSetIndex.MaskStats(), params.verbosity > 1);
+        }
+        return 0;
+    }
+};
+
+// Maps every query against the reference with the pipeline for one seed size
+struct MapRunner {
+    const SrsliParameters& params;
+    const ReferenceSet& refSet;
+
+    MapRunner(const SrsliParameters& p, const ReferenceSet& r)
+        : params( p )
+        , refSet( r )
+    {}
+
+    template<typename TConfig>
+    int Run()
+    {
+        // Sample the reference into a sparse minimizer index if asked to
+        if (params.minimizerWindow > 0)
+        {
+            if (!params.indexFile.empty() || params.forwardIndex)
+                throw std::runtime_error("ERROR: The minimizer index is built in memory and"
+                                         " covers both strands, it can't be combined with"
+                                         " --index or --forwardIndex");
+            MinimizerIndex<TConfig> refSetIndex;
+            refSetIndex.Build(refSet, params.minimizerWindow, params.maxOccurrences);
+            if (params.verbosity > 1)
+                std::cerr << "Sampled " << refSetIndex.Length() << " minimizers of "
+                          << refSet.Size() << " reference positions ("
+                          << refSetIndex.MemoryUsage() << " bytes), masking "
+                          << refSetIndex.MaskedKeys() << " repeats" << std::endl;
+            return MapQueries<TConfig>(refSetIndex);
+        }
+
+        // Otherwise map the saved index if we were given one, whose strands
+        //    and masking were fixed when it was built, or build it up-front,
+        //    since workers only ever read it
+        if (!params.indexFile.empty() &&
+                (params.forwardIndex || params.maxOccurrences > 0 || params.maskFraction > 0.0))
+            throw std::runtime_error("ERROR: --forwardIndex, --maxOccurrences and --maskFraction"
+                                     " only apply when building an index, give them to"
+                                     " 'srsli index' instead of combining them with --index");
+        QGramIndex<TConfig> refSetIndex;
+        if (params.indexFile.empty())
+            refSetIndex.Build(refSet, params.forwardIndex,
+                              params.maxOccurrences, params.maskFraction);
+        else
+            refSetIndex.Open(params.indexFile, refSet);
+        if (params.verbosity > 1)
+            ReportMasking(refSetIndex.MaskStats(), params.verbosity > 2);
+        return MapQueries<TConfig>(refSetIndex);
+    }
+
+    template<typename TConfig, typename TIndex>
+    int MapQueries(const TIndex& refSetIndex)
+    {
+        // Use the options to set the configs and scoring schemes
+        Score<int64_t, Simple> scoringScheme(4, -13, -7);
+
+        // Read and parse the queries ahead of the workers on a thread of
+        //    their own.  Declared first, since it must outlive its batches
+        SequenceReader seqReader(params.query,
+                                 params.batchSize,
+                                 2 * std::max(params.numThreads, 1),
+                                 params.readerThreads);
+
+        // Write each batch's results out in input order as soon as they're
+        //    ready.  Declared before the pool, so that workers unwinding from
+        //    an error are stopped before the writer goes away
+        FILE* out;
+        std::unique_ptr<ResultSink> sink = OpenResultSink(out, params, refSet,
+                                                         seqReader.ReadGroupHeader());
+        ResultWriter writer(*sink, 4 * std::max(params.numThreads, 1), params.backgroundWriter);
+
+        // Start the workers, each with its own seed and chain buffers.  The
+        //    buffers are declared first, so that they outlive any tasks the
+        //    pool is still draining when an error unwinds us
+        std::vector<QueryScratch> workerScratch(std::max(params.numThreads, 1));
+        ThreadPool pool(workerScratch.size());
+        const size_t maxBatchesInFlight = 2 * pool.Size();
+
+        // Take each batch of queries as the reader has it ready...
+        while (std::shared_ptr<SequenceBatch> batch = seqReader.NextBatch()) {
+            size_t slot = writer.Reserve();
+
+            // ... and hand it to whichever worker is free, which passes its
+            //    results on to the writer, or none if mapping fails
+            pool.Submit([&, batch, slot]() {
+                QueryScratch& scratch = workerScratch[pool.CurrentWorker()];
+                std::vector<AlignmentRecord> batchOutput;
+                try {
+                    MapQueryBatch<TConfig>(batchOutput,
+                                           *batch,
+                                           refSetIndex,
+                                           refSet,
+                                           params,
+                                           scoringScheme,
+                                           scratch,
+                                           &pool);
+                } catch (...) {
+                    batchOutput.clear();
+                    writer.Deliver(slot, batchOutput, batch);
+                    throw;
+                }
+                writer.Deliver(slot, batchOutput, batch);
+            });
+
+            // Don't read too far ahead of the workers
+            pool.Wait(maxBatchesInFlight);
+        }
+        pool.Wait();
+        writer.Close();
+
+        // Let go of the sink before closing the file it writes to
+        sink.reset();
+        if (out != stdout && fclose(out) != 0)
+            throw std::runtime_error("ERROR: Could not write the output file " + params.outputFile);
+
+        // Report how quickly the chosen seeder found its hits
+        if (params.verbosity > 1)
+        {
+            size_t numSeedHits = 0;
+            size_t numSkippedKmers = 0;
+            double seedingSeconds = 0.0;
+            for (size_t i = 0; i < workerScratch.size(); ++i)
+            {
+                numSeedHits += workerScratch[i].numSeedHits;
+                numSkippedKmers += workerScratch[i].numSkippedKmers;
+                seedingSeconds += workerScratch[i].seedingSeconds;
+            }
+            std::cerr << "Seeding (" << params.seeder << "): " << numSeedHits << " hits in "
+                      << seedingSeconds << " thread-seconds, "
+                      << numSeedHits / std::max(seedingSeconds, 1e-9) << " hits/second" << std::endl;
+            if (params.minQuality > 0)
+                std::cerr << "Skipped " << numSkippedKmers << " Kmers in low-quality"
+                          << " stretches of the queries" << std::endl;
+        }
+
+        if (params.verbosity > 1)
+            std::cerr << "Wrote " << writer.RecordsWritten() << " alignments" << std::endl;
+        return 0;
+    }
+};
+
+// Entry point for 'srsli index', which builds and saves the reference index
+int IndexMain(int argc, char const ** argv) {
+
+    // Parse the command-line arguments into usable parameters
+    IndexParameters params(argc, argv);
+
+    // Abort if we could not parse the supplied arguments
+    if (params.parseOk == 0)
+        return 1;
+
+    ReferenceSet refSet(params.reference);
+    IndexRunner runner(params, refSet);
+    return DispatchSeedSize(params.seedSize, runner);
+}
+
 // Entry point
 int main(int argc, char const ** argv) {
 
+    // Hand off to the index builder if that is what was asked for
+    if (argc > 1 && std::string(argv[1]) == "index")
+        return IndexMain(argc - 1, argv + 1);
+
     // Parse the command-line arguments into usable parameters
     SrsliParameters params(argc, argv);
 
@@ -34,79 +271,9 @@ int main(int argc, char const ** argv) {
     if (params.parseOk == 0)
         return 1;
 
-    // Use the options to set the configs and scoring schemes
-    Score<int64_t, Simple> scoringScheme(4, -13, -7);
-
-    // Read the reference sequences into memory
-    typedef FindSeedsConfig<12> TConfig;
-    ReferenceSet refSet = ReferenceSet(params.reference);
-    auto refSetIndex = refSet.GetIndex<TConfig>();
-    indexRequire(refSetIndex, QGramSADir());  // On-demand index creation.
-
-    // Create an iterator for the query sequences and a pair for it to return to
-    SequenceReader seqReader = SequenceReader(params.query);
-    std::pair<size_t, SequenceRecord> idxAndRecord;
-
-    // Define the variable where the initial hits for the query will be stored
-    std::vector<TSeedSet> querySeedSets(2, TSeedSet());
-    std::vector<std::vector<TSeed>> querySeedHits(2);
-    std::vector<ReferencedSeedChain> querySeedChains;
-
-    // Initialize the vector that will get the alignment results
-    std::vector<AlignmentRecord> results;
-
-    for ( ; seqReader.GetNext(idxAndRecord) ; ) {
-        // Display current query
-        SequenceRecord* record = &idxAndRecord.second;
-        std::cout << "Query #" << idxAndRecord.first+1
-                  << " - " << record->Id << std::endl;
-
-        // Calculate the maximum expected interval size, given the query length
-        size_t maxIntervalLength = length(record->Seq) * params.maxNetIndelRate;
-
-        // Find the Kmer matches for the current query sequence
-        std::cout << "Looking for seeds" << std::endl;
-        FindSeeds(querySeedSets, refSetIndex, refSet.Size(), record->Seq);
-        std::cout << "Finished finding seeds" << std::endl;
-
-        // Sort the Kmer matches by reference position, which involves
-        //    converting them to vectors
-        std::cout << "Sorting seeds" << std::endl;
-        SeedSetsToSeedVectors(querySeedSets, querySeedHits);
-        std::cout << "Finished sorting seeds" << std::endl;
-
-        std::cout << "Selecting seed intervals" << std::endl;
-        std::vector<SeedInterval> seedIntervals;
-        GetSeedIntervals(seedIntervals, querySeedHits, maxIntervalLength);
-        std::cout << "Finished selecting seed intervals" << std::endl;
-
-        std::cout << "Converting seed intervals to seed chains" << std::endl;
-        SeedIntervalsToSeedChains(querySeedChains,
-                                  querySeedHits,
-                                  seedIntervals);
-        std::cout << "Finished conversion to seed chains" << std::endl;
-
-        int maxAligns = std::min((int)querySeedChains.size(), params.nCandidates);
-
-        // Chain the initial Kmer hits into an alignment
-        RefChainsToAlignments(results,
-                              record->Seq,
-                              refSet,
-                              querySeedChains,
-                              scoringScheme,
-                              maxAligns,
-                              params.minAccuracy,
-                              params.maxChainBuffer,
-                              params.alignmentAnchor);
-
-        // Empty the seedHits variable before the next iteration
-        querySeedHits.clear();
-    }
-
-    std::cout << results.size() << std::endl;
-    std::cout << M1Header << std::endl;
-    for (size_t i = 0; i < results.size(); ++i)
-    {
-        std::cout << results[i].toM1Record() << std::endl;
-    }
+    // Read the reference sequences into memory, then run the pipeline
+    //    compiled for the requested seed size
+    ReferenceSet refSet(params.reference);
+    MapRunner runner(params, refSet);
+    return DispatchSeedSize(params.seedSize, runner);
 }
@@ -0,0 +1,130 @@
+// Author: Brett Bowman
+
+#pragma once
+
+#include "Version.hpp"
+#include "../config/SeedSizeDispatch.hpp"
+
+using namespace srsli;
+
+// Parameters for the 'srsli index' sub-command, which builds the q-gram
+//    index for a reference once and saves it for later mapping runs
+class IndexParameters {
+    public:
+        // Constructor
+        IndexParameters(int, char const **);
+
+        // Positional (Required) Arguments
+        std::string reference;
+
+        // Optional Arguments
+        std::string outputFile;
+        int seedSize;
+        bool forwardIndex;
+        int maxOccurrences;
+        double maskFraction;
+        int verbosity;
+
+        // Hidden and fixed parameters
+        int parseOk;
+
+    private:
+        seqan::ArgumentParser parser;
+        seqan::ArgumentParser::ParseResult result;
+
+    void Initialize()
+    {
+        if (parseOk == 0)
+            return;
+
+        // Extract Positional Arguments into variables
+        getArgumentValue(reference, parser, 0);
+
+        // Extract Optional Arguments into variables
+        getOptionValue(outputFile,  parser, "output");
+        getOptionValue(seedSize,    parser, "seedSize");
+        forwardIndex = isSet(parser, "forwardIndex");
+        getOptionValue(maxOccurrences, parser, "maxOccurrences");
+        getOptionValue(maskFraction,   parser, "maskFraction");
+        getOptionValue(verbosity,   parser, "verbosity");
+
+        // Default to writing the index next to the reference
+        if (outputFile.empty())
+            outputFile = reference + ".qgi";
+    }
+
+    seqan::ArgumentParser SetupParser()
+    {
+        // Setup ArgumentParser.
+        seqan::ArgumentParser parser("srsli index");
+        setDate(parser, srsli::Version::Date());
+        setVersion(parser, srsli::Version::VersionString());
+        setShortDescription(parser,
+                "Build and save the q-gram index for a reference");
+        addDescription(parser, "Build the q-gram index srsli uses to find seeds"
+                " and write it to disk, so that mapping runs can map it"
+                " directly instead of rebuilding it every time");
+        addUsageLine(parser,  "\\fIREFERENCE\\fP [\\fIOPTIONS\\fP]");
+
+        // Define Required (Positional) Arguments
+        addArgument(parser, ArgParseArgument(
+                    ArgParseArgument::STRING, "REFERENCE"));
+
+        // Define Optional arguments
+        addOption(parser, ArgParseOption(
+                "o", "output", "File to write the index to [REFERENCE.qgi].",
+                ArgParseArgument::OUTPUTFILE, "FILE"));
+        addOption(parser, ArgParseOption(
+                "s", "seedSize", "Size of the seeds to index, which mapping runs"
+                " using this index must match.",
+                ArgParseArgument::INTEGER, "INT"));
+        addOption(parser, ArgParseOption(
+                "f", "forwardIndex", "Index only the forward strand of the reference, and"
+                " look up both orientations of each query Kmer instead."));
+        addOption(parser, ArgParseOption(
+                "c", "maxOccurrences", "Mask Kmers occurring more often than this in the"
+                " reference, counting both strands (0 = no limit).",
+                ArgParseArgument::INTEGER, "INT"));
+        addOption(parser, ArgParseOption(
+                "x", "maskFraction", "Mask this fraction of the most frequent distinct"
+                " Kmers in the reference (0 = none).",
+                ArgParseArgument::DOUBLE, "FLOAT"));
+        addOption(parser, ArgParseOption(
+                "v", "verbosity",
+                "Verbosity of process information to report [0..3].",
+                ArgParseArgument::INTEGER, "INT"));
+
+        // Set default values
+        setDefaultValue(parser, "seedSize",    "12");
+        setMinValue(parser,     "seedSize",    std::to_string(MinSeedSize));
+        setMaxValue(parser,     "seedSize",    std::to_string(MaxQGramSeedSize));
+        setDefaultValue(parser, "maxOccurrences", "0");
+        setMinValue(parser,     "maxOccurrences", "0");
+        setDefaultValue(parser, "maskFraction",   "0");
+        setMinValue(parser,     "maskFraction",   "0");
+        setMaxValue(parser,     "maskFraction",   "1");
+        setDefaultValue(parser, "verbosity",   "1");
+
+        return parser;
+    }
+
+    void ParseArguments(int argc, char const ** argv)
+    {
+        result = parse(parser, argc, argv);
+
+        // Set the ParseOk flag if ... we parsed the arguments Ok
+        if (result == seqan::ArgumentParser::PARSE_OK)
+        {
+            parseOk = 1;
+        } else {
+            parseOk = 0;
+        }
+    }
+};
+
+IndexParameters::IndexParameters(int argc, char const ** argv)
+{
+    parser = SetupParser();
+    ParseArguments(argc, argv);
+    Initialize();
+}
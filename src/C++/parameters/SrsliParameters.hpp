@@ -3,6 +3,7 @@
 #pragma once
 
 #include "Version.hpp"
+#include "../config/SeedSizeDispatch.hpp"
 
 using namespace srsli;
 
@@ -19,14 +20,41 @@ class SrsliParameters {
         int minScore;
         int nCandidates;
         int seedSize;
+        std::string indexFile;
+        std::string seeder;
+        std::string chainer;
+        std::string aligner;
+        std::string outputFile;
+        std::string outputFormat;
+        int numThreads;
+        bool forwardIndex;
+        int maxOccurrences;
+        int minimizerWindow;
+        double maskFraction;
+        int minQuality;
+        bool prefilter;
         int verbosity;
 
         // Hidden and fixed parameters
         float maxNetIndelRate;
         float minAccuracy;
         int maxChainBuffer;
+        float chainGapCost;
+        float chainIndelCost;
+        int chainLookback;
+        int alignBandWidth;
+        int alignMinBandWidth;
+        int xDrop;
+        int maxExtension;
+        int batchGapFillLength;
+        int qualityWindow;
+        int parallelReadLength;
+        int parallelBlockLength;
         int parseOk;
         int alignmentAnchor;
+        int batchSize;
+        int readerThreads;
+        bool backgroundWriter;
 
     private:
         seqan::ArgumentParser parser;
@@ -45,13 +73,40 @@ class SrsliParameters {
         getOptionValue(minScore,    parser, "minScore");
         getOptionValue(nCandidates, parser, "nCandidates");
         getOptionValue(seedSize,    parser, "seedSize");
+        getOptionValue(indexFile,   parser, "index");
+        getOptionValue(seeder,      parser, "seeder");
+        getOptionValue(chainer,     parser, "chainer");
+        getOptionValue(aligner,     parser, "aligner");
+        getOptionValue(numThreads,  parser, "threads");
+        forwardIndex = isSet(parser, "forwardIndex");
+        getOptionValue(maxOccurrences, parser, "maxOccurrences");
+        getOptionValue(maskFraction,   parser, "maskFraction");
+        getOptionValue(minimizerWindow, parser, "window");
+        getOptionValue(minQuality,  parser, "minQuality");
+        prefilter = isSet(parser, "prefilter");
         getOptionValue(verbosity,   parser, "verbosity");
+        getOptionValue(outputFile,  parser, "output");
+        getOptionValue(outputFormat, parser, "format");
 
         // Set hiddeen parameters
         maxNetIndelRate = 1.30;
         minAccuracy = 60.0;
         maxChainBuffer = 25;
+        chainGapCost = 0.01;
+        chainIndelCost = 0.12;
+        chainLookback = 50;
+        alignBandWidth = 128;
+        alignMinBandWidth = 32;
+        xDrop = 400;
+        maxExtension = 2000;
+        batchGapFillLength = 256;
+        qualityWindow = 11;
+        parallelReadLength = 20000;
+        parallelBlockLength = 10000;
         alignmentAnchor = 6;
+        batchSize = 32;
+        readerThreads = 2;
+        backgroundWriter = true;
     }
 
     seqan::ArgumentParser SetupParser()
@@ -67,6 +122,7 @@ class SrsliParameters {
                 " local indexing, then refine the results with standard dynamic"
                 " programming methods");
         addUsageLine(parser,  "\\fIQUERY\\fP \\fIREFERENCE\\fP [\\fIOPTIONS\\fP]");
+        addUsageLine(parser,  "index \\fIREFERENCE\\fP [\\fIOPTIONS\\fP]");
 
         // Define Required (Positional) Arguments
         addArgument(parser, ArgParseArgument(
@@ -82,7 +138,67 @@ class SrsliParameters {
                 "n", "nCandidates", "Number of candidate alignments to score",
                 ArgParseArgument::INTEGER, "INT"));
         addOption(parser, ArgParseOption(
-                "s", "seedSize", "Size to use when searching for alignment seeds.",
+                "s", "seedSize", "Size to use when searching for alignment seeds.  Sizes"
+                " over 13 need a minimizer index (--window).",
+                ArgParseArgument::INTEGER, "INT"));
+        addOption(parser, ArgParseOption(
+                "i", "index", "Pre-built index of the reference, from 'srsli index'.",
+                ArgParseArgument::INPUTFILE, "FILE"));
+        addOption(parser, ArgParseOption(
+                "f", "forwardIndex", "Index only the forward strand of the reference, and"
+                " look up both orientations of each query Kmer instead."));
+        addOption(parser, ArgParseOption(
+                "c", "maxOccurrences", "Mask Kmers occurring more often than this in the"
+                " reference, counting both strands (0 = no limit).",
+                ArgParseArgument::INTEGER, "INT"));
+        addOption(parser, ArgParseOption(
+                "x", "maskFraction", "Mask this fraction of the most frequent distinct"
+                " Kmers in the reference (0 = none).",
+                ArgParseArgument::DOUBLE, "FLOAT"));
+        addOption(parser, ArgParseOption(
+                "w", "window", "Index only the minimizer of every window of this many"
+                " reference Kmers, and seed from the query's minimizers (0 = index"
+                " every Kmer).",
+                ArgParseArgument::INTEGER, "INT"));
+        addOption(parser, ArgParseOption(
+                "e", "seeder", "Seeding engine: the rolling q-gram lookup, or the"
+                " vectorized, prefetching direct lookup (seed sizes up to 16).",
+                ArgParseArgument::STRING, "STR"));
+        setValidValues(parser, "seeder", "qgram direct");
+        addOption(parser, ArgParseOption(
+                "q", "minQuality", "Skip query Kmers covering any base whose mean quality,"
+                " over a window of bases around it, falls below this (0 = seed from"
+                " every Kmer).  Queries without qualities are seeded in full.",
+                ArgParseArgument::INTEGER, "INT"));
+        addOption(parser, ArgParseOption(
+                "", "chainer", "Seed chaining engine: gap-scored chains weighted by seed"
+                " rarity, or the longest chain in each seed interval, found with one"
+                " sliding sweep over each reference or by SeqAn's chaining.",
+                ArgParseArgument::STRING, "STR"));
+        setValidValues(parser, "chainer", "scored window seqan");
+        addOption(parser, ArgParseOption(
+                "", "aligner", "Alignment engine for refining each seed chain: a"
+                " vectorized banded aligner following the chain, the gaps between"
+                " seeds of a whole batch of queries aligned together one per SIMD"
+                " lane (extensions past the chain and gaps over 256 bases align"
+                " one at a time), or SeqAn's banded chain alignment.",
+                ArgParseArgument::STRING, "STR"));
+        setValidValues(parser, "aligner", "simd batch seqan");
+        addOption(parser, ArgParseOption(
+                "p", "prefilter", "Skip the alignment of candidate chains whose edit"
+                " distance to the reference rules out reaching the minimum accuracy,"
+                " before clipping.  Clipping the ends of an alignment can still lift"
+                " a few such chains above it, so a handful may be lost."));
+        addOption(parser, ArgParseOption(
+                "o", "output", "File to write alignments to ('-' for standard output).",
+                ArgParseArgument::OUTPUTFILE, "FILE"));
+        addOption(parser, ArgParseOption(
+                "", "format", "Output format: PacBio's M1 text, SAM, or BAM compressed"
+                " on as many threads as mapping uses.",
+                ArgParseArgument::STRING, "STR"));
+        setValidValues(parser, "format", "m1 sam bam");
+        addOption(parser, ArgParseOption(
+                "j", "threads", "Number of worker threads to map queries with.",
                 ArgParseArgument::INTEGER, "INT"));
         addOption(parser, ArgParseOption(
                 "v", "verbosity",
@@ -93,6 +209,24 @@ class SrsliParameters {
         setDefaultValue(parser, "minScore",    "1000");
         setDefaultValue(parser, "nCandidates", "5");
         setDefaultValue(parser, "seedSize",    "12");
+        setMinValue(parser,     "seedSize",    std::to_string(MinSeedSize));
+        setMaxValue(parser,     "seedSize",    std::to_string(MaxSeedSize));
+        setDefaultValue(parser, "seeder",      "qgram");
+        setDefaultValue(parser, "chainer",     "scored");
+        setDefaultValue(parser, "aligner",     "simd");
+        setDefaultValue(parser, "output",      "-");
+        setDefaultValue(parser, "format",      "m1");
+        setDefaultValue(parser, "threads",     "1");
+        setMinValue(parser,     "threads",     "1");
+        setDefaultValue(parser, "maxOccurrences", "0");
+        setMinValue(parser,     "maxOccurrences", "0");
+        setDefaultValue(parser, "maskFraction",   "0");
+        setMinValue(parser,     "maskFraction",   "0");
+        setMaxValue(parser,     "maskFraction",   "1");
+        setDefaultValue(parser, "window",         "0");
+        setMinValue(parser,     "window",         "0");
+        setDefaultValue(parser, "minQuality",     "0");
+        setMinValue(parser,     "minQuality",     "0");
         setDefaultValue(parser, "verbosity",   "1");
             
         return parser;
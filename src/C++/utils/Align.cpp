@@ -1,127 +1,144 @@
 #pragma once
 
+#include <stdint.h>
+#include <vector>
+
 #include <seqan/align.h>
 
 #include "../config/SeqAnConfig.hpp"
+#include "../config/Types.hpp"
 
-void ClipAlignment(TAlign& alignment,
-                   const int minAlignmentAnchorSize = 6)
+inline CigarUnit MakeCigarUnit(const size_t length, const CigarOp op)
 {
-    int startAnchorLength = 0;
-    int endAnchorLength = 0;
-    int clipStart = -1;
-    int clipEnd   = -1;
-
-    auto &query     = row(alignment, 0);
-    auto &reference = row(alignment, 1);
-
-    // Find the first string of Anchor-length matches in the alignment
-    for (size_t i = 0; i < length(reference); ++i)
-    {
-        if (reference[i] != '-' && reference[i] == query[i]) {
-            if (startAnchorLength == 0)
-                clipStart = i;
-            ++startAnchorLength;
-        } else {
-            startAnchorLength = 0;
-        }
-        
-        if (startAnchorLength >= minAlignmentAnchorSize)
-            break;
-    }
+    return ((CigarUnit)length << 4) | op;
+}
 
-    // Find the last string of Anchor-length matches in the alignment
-    for (size_t i = length(reference)-1; i > 0; --i)
-    {
-        char refBase = reference[i];
-        if (refBase != '-' && refBase == query[i]) {
-            if (endAnchorLength == 0)
-                clipEnd = i+1;
-            ++endAnchorLength;
-        } else {
-            endAnchorLength = 0;
-        }
-        
-        if (endAnchorLength >= minAlignmentAnchorSize)
-            break;
-    }
+inline size_t CigarLength(const CigarUnit unit)
+{
+    return unit >> 4;
+}
 
-    // Set the identified clipping positions
-    setClippedBeginPosition(query,     clipStart);
-    setClippedEndPosition(query,       clipEnd);
-    setClippedBeginPosition(reference, clipStart);
-    setClippedEndPosition(reference,   clipEnd);
+inline CigarOp CigarOperation(const CigarUnit unit)
+{
+    return (CigarOp)(unit & 0xF);
 }
 
-float AlignmentAccuracy(const Align<Dna5String, ArrayGaps>& alignment,
-                        const size_t queryIdx,
-                        const size_t refIdx)
+// Add a run of columns to the end of an alignment, extending its last run
+//    if that has the same operation
+inline void AppendCigar(std::vector<CigarUnit>& cigar,
+                        const CigarOp op,
+                        const size_t length)
 {
-    size_t total = 0;
-    size_t matches = 0;
-    size_t mismatches = 0;
-    size_t insertions = 0;
-    size_t deletions = 0;
+    if (length == 0)
+        return;
+    if (!cigar.empty() && CigarOperation(cigar.back()) == op)
+        cigar.back() += (CigarUnit)length << 4;
+    else
+        cigar.push_back(MakeCigarUnit(length, op));
+}
 
-    auto &query = row(alignment, queryIdx);
-    auto &reference = row(alignment, refIdx);
+// Run-length encode a pairwise alignment of a query (row 0) and reference
+//    (row 1), walking the two rows' gaps once with iterators
+void AlignToCigar(std::vector<CigarUnit>& cigar,
+                  TAlign& alignment)
+{
+    typedef Iterator<TRow>::Type TRowIter;
+    TRow& query = row(alignment, 0);
+    TRow& reference = row(alignment, 1);
+    const TDna& querySeq = source(query);
+    const TDna& refSeq = source(reference);
 
-    for (size_t i = 0; i < length(reference); ++i)
+    cigar.clear();
+    size_t queryPos = 0, refPos = 0;
+    TRowIter queryIt = begin(query), queryEnd = end(query);
+    TRowIter refIt = begin(reference), refEnd = end(reference);
+    for ( ; queryIt != queryEnd && refIt != refEnd; ++queryIt, ++refIt)
     {
-        char refBase = query[i];
-        char queryBase = reference[i];
-        if (refBase == '-' && queryBase != '-') {
-            total += 1;
-            insertions += 1;
-        } else if (refBase == queryBase) {
-            total += 1;
-            matches += 1;
-        } else if (queryBase == '-') {
-            total += 1;
-            deletions += 1;
+        bool queryGap = isGap(queryIt);
+        bool refGap = isGap(refIt);
+        if (queryGap && refGap)
+            continue;
+        if (queryGap) {
+            AppendCigar(cigar, CigarDeletion, 1);
+            ++refPos;
+        } else if (refGap) {
+            AppendCigar(cigar, CigarInsertion, 1);
+            ++queryPos;
         } else {
-            total += 1;
-            mismatches += 1;
+            AppendCigar(cigar, (querySeq[queryPos] == refSeq[refPos]) ? CigarMatch : CigarMismatch, 1);
+            ++queryPos;
+            ++refPos;
         }
     }
-    return 100.0*(float)matches/(float)total;
 }
 
-size_t CountUnalignedStartBases(const TRow& row)
+// Gap the rows of an alignment, whose sources are already set, to match a
+//    run-length encoded alignment of them
+void CigarToAlign(TAlign& alignment,
+                  const std::vector<CigarUnit>& cigar)
 {
-    size_t count = 0;
-    for (size_t i = 0; i < length(source(row)); ++i)
+    TRow& query = row(alignment, 0);
+    TRow& reference = row(alignment, 1);
+    size_t viewPos = 0;
+    for (size_t i = 0; i < cigar.size(); ++i)
     {
-        auto pos = toViewPosition(row, i);
-        if (pos >= 0)
-            break;
-        ++count;
+        size_t length = CigarLength(cigar[i]);
+        if (CigarOperation(cigar[i]) == CigarInsertion)
+            insertGaps(reference, viewPos, length);
+        else if (CigarOperation(cigar[i]) == CigarDeletion)
+            insertGaps(query, viewPos, length);
+        viewPos += length;
     }
-    return count;
 }
 
-size_t CountUnalignedStartBases(const TAlign& alignment,
-                                const int rowNum)
+// Clip both ends of an alignment back to its outermost runs of at least
+//    minAlignmentAnchorSize matching columns, in place, and count the columns
+//    left by type and the bases clipped from each sequence.  An alignment
+//    with no such run is left whole
+void ClipCigar(std::vector<CigarUnit>& cigar,
+               AlignmentStats& stats,
+               const size_t minAlignmentAnchorSize = 6)
 {
-    return CountUnalignedStartBases(row(alignment, rowNum));
-}
+    AlignmentStats empty = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    stats = empty;
 
-size_t CountUnalignedEndBases(const TRow& row)
-{
-    auto endPos = length(row);
-    size_t count = 0;
-    for (size_t i = length(source(row))-1; i > 0; --i)
+    size_t first = 0, last = cigar.size();
+    while (first < cigar.size() && !(CigarOperation(cigar[first]) == CigarMatch &&
+                                     CigarLength(cigar[first]) >= minAlignmentAnchorSize))
+        ++first;
+    while (last > first && !(CigarOperation(cigar[last-1]) == CigarMatch &&
+                             CigarLength(cigar[last-1]) >= minAlignmentAnchorSize))
+        --last;
+    if (first == cigar.size())
     {
-        auto pos = toViewPosition(row, i);
-        if (pos <= endPos)
-            break;
-        ++count;
+        first = 0;
+        last = cigar.size();
     }
-    return count;
-}
 
-size_t CountUnalignedEndBases(const TAlign& alignment,
-                              const int rowNum)
-{
-    return CountUnalignedEndBases(row(alignment, rowNum));
+    for (size_t i = 0; i < cigar.size(); ++i)
+    {
+        size_t length = CigarLength(cigar[i]);
+        CigarOp op = CigarOperation(cigar[i]);
+        size_t* queryCount = (i < first) ? &stats.queryStartClip : &stats.queryEndClip;
+        size_t* refCount = (i < first) ? &stats.refStartClip : &stats.refEndClip;
+        if (i >= first && i < last)
+        {
+            if (op == CigarMatch)
+                stats.matches += length;
+            else if (op == CigarMismatch)
+                stats.mismatches += length;
+            else if (op == CigarInsertion)
+                stats.insertions += length;
+            else
+                stats.deletions += length;
+            continue;
+        }
+        if (op != CigarDeletion)
+            *queryCount += length;
+        if (op != CigarInsertion)
+            *refCount += length;
+    }
+
+    cigar.erase(cigar.begin() + last, cigar.end());
+    cigar.erase(cigar.begin(), cigar.begin() + first);
 }
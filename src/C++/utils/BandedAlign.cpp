@@ -0,0 +1,584 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+
+// Begin Utility Classes
+// One step of a banded alignment's traceback, which doubles as the direction
+//    the DP came from: consume a base of both sequences, of only the query
+//    (a gap in the reference), or of only the reference (a gap in the query)
+enum BandedAlignOp {
+    BandedAlignMatch = 0,
+    BandedAlignInsertion = 1,
+    BandedAlignDeletion = 2
+};
+
+// Where an alignment may end: at the far corner, anywhere on the last row or
+//    column, or, extending out from its start, at its best cell anywhere
+enum BandedAlignEnd {
+    BandedAlignGlobal,
+    BandedAlignSemiGlobal,
+    BandedAlignExtend
+};
+
+// Linear-gap scoring, the range of band widths in cells per anti-diagonal,
+//    how the alignment ends and, for extensions, how far below the best
+//    score seen an anti-diagonal may fall before the extension stops
+struct BandedAlignParams {
+    int match;
+    int mismatch;
+    int gap;
+    size_t bandWidth;
+    size_t minBandWidth;
+    BandedAlignEnd end;
+    long xDrop;
+};
+
+// Reusable buffers for BandedAlign, since they grow with the region aligned
+struct BandedAlignBuffers {
+    std::vector<uint8_t> query;
+    std::vector<uint8_t> reverseRef;
+    std::vector<std::pair<long, long>> points;
+    std::vector<long> centers;
+    std::vector<size_t> widths;
+    std::vector<long> bandStarts;
+    std::vector<uint8_t> directions;
+    std::vector<int16_t> cells16;
+    std::vector<int32_t> cells32;
+};
+
+// The vector operations the banded kernel is written in: one lane per cell,
+//    with 16-bit lanes saturating.  The generic version works one cell at a time
+template<typename TScore>
+struct BandLanes {
+    typedef int32_t TVec;
+    static const size_t Size = 1;
+
+    static inline TVec Load(const TScore* p) { return *p; }
+    static inline void Store(TScore* p, TVec v) { *p = (TScore)v; }
+    static inline TVec Set(int32_t x) { return x; }
+    static inline TVec Add(TVec a, TVec b)
+    {
+        int64_t sum = (int64_t)a + b;
+        sum = std::max<int64_t>(sum, std::numeric_limits<TScore>::min());
+        return (TVec)std::min<int64_t>(sum, std::numeric_limits<TScore>::max());
+    }
+    static inline TVec Max(TVec a, TVec b) { return std::max(a, b); }
+    static inline TVec Equal(TVec a, TVec b) { return a == b ? -1 : 0; }
+    static inline TVec Matches(const uint8_t* q, const uint8_t* r) { return *q == *r ? -1 : 0; }
+    static inline TVec Select(TVec mask, TVec a, TVec b) { return mask ? a : b; }
+    static inline void StoreDirections(uint8_t* out, TVec dirs) { *out = (uint8_t)dirs; }
+    static inline int32_t HorizontalMax(TVec v) { return v; }
+    static inline int FirstEqual(TVec v, int32_t x) { return v == x ? 0 : -1; }
+    static inline bool AnyBelow(TVec v, int32_t x) { return v < x; }
+};
+
+#if defined(__AVX2__)
+template<>
+struct BandLanes<int16_t> {
+    typedef __m256i TVec;
+    static const size_t Size = 16;
+
+    static inline TVec Load(const int16_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static inline void Store(int16_t* p, TVec v) { _mm256_storeu_si256((__m256i*)p, v); }
+    static inline TVec Set(int32_t x) { return _mm256_set1_epi16((int16_t)x); }
+    static inline TVec Add(TVec a, TVec b) { return _mm256_adds_epi16(a, b); }
+    static inline TVec Max(TVec a, TVec b) { return _mm256_max_epi16(a, b); }
+    static inline TVec Equal(TVec a, TVec b) { return _mm256_cmpeq_epi16(a, b); }
+    static inline TVec Matches(const uint8_t* q, const uint8_t* r)
+    {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)q),
+                                    _mm_loadu_si128((const __m128i*)r));
+        return _mm256_cvtepi8_epi16(eq);
+    }
+    static inline TVec Select(TVec mask, TVec a, TVec b) { return _mm256_blendv_epi8(b, a, mask); }
+    static inline void StoreDirections(uint8_t* out, TVec dirs)
+    {
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(dirs, dirs), 0xD8);
+        _mm_storeu_si128((__m128i*)out, _mm256_castsi256_si128(packed));
+    }
+    static inline int32_t HorizontalMax(TVec v)
+    {
+        __m128i m = _mm_max_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        m = _mm_max_epi16(m, _mm_srli_si128(m, 8));
+        m = _mm_max_epi16(m, _mm_srli_si128(m, 4));
+        m = _mm_max_epi16(m, _mm_srli_si128(m, 2));
+        return (int16_t)_mm_extract_epi16(m, 0);
+    }
+    static inline int FirstEqual(TVec v, int32_t x)
+    {
+        int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(v, Set(x)));
+        return mask ? __builtin_ctz(mask) / 2 : -1;
+    }
+    static inline bool AnyBelow(TVec v, int32_t x)
+    {
+        return _mm256_movemask_epi8(_mm256_cmpgt_epi16(Set(x), v)) != 0;
+    }
+};
+
+template<>
+struct BandLanes<int32_t> {
+    typedef __m256i TVec;
+    static const size_t Size = 8;
+
+    static inline TVec Load(const int32_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static inline void Store(int32_t* p, TVec v) { _mm256_storeu_si256((__m256i*)p, v); }
+    static inline TVec Set(int32_t x) { return _mm256_set1_epi32(x); }
+    static inline TVec Add(TVec a, TVec b) { return _mm256_add_epi32(a, b); }
+    static inline TVec Max(TVec a, TVec b) { return _mm256_max_epi32(a, b); }
+    static inline TVec Equal(TVec a, TVec b) { return _mm256_cmpeq_epi32(a, b); }
+    static inline TVec Matches(const uint8_t* q, const uint8_t* r)
+    {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadl_epi64((const __m128i*)q),
+                                    _mm_loadl_epi64((const __m128i*)r));
+        return _mm256_cvtepi8_epi32(eq);
+    }
+    static inline TVec Select(TVec mask, TVec a, TVec b) { return _mm256_blendv_epi8(b, a, mask); }
+    static inline void StoreDirections(uint8_t* out, TVec dirs)
+    {
+        __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(dirs, dirs), 0xD8);
+        __m128i bytes = _mm_packs_epi16(_mm256_castsi256_si128(words), _mm256_castsi256_si128(words));
+        _mm_storel_epi64((__m128i*)out, bytes);
+    }
+    static inline int32_t HorizontalMax(TVec v)
+    {
+        __m128i m = _mm_max_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        m = _mm_max_epi32(m, _mm_srli_si128(m, 8));
+        m = _mm_max_epi32(m, _mm_srli_si128(m, 4));
+        return _mm_cvtsi128_si32(m);
+    }
+    static inline int FirstEqual(TVec v, int32_t x)
+    {
+        int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi32(v, Set(x)));
+        return mask ? __builtin_ctz(mask) / 4 : -1;
+    }
+    static inline bool AnyBelow(TVec v, int32_t x)
+    {
+        return _mm256_movemask_epi8(_mm256_cmpgt_epi32(Set(x), v)) != 0;
+    }
+};
+#elif defined(__SSE4_1__)
+template<>
+struct BandLanes<int16_t> {
+    typedef __m128i TVec;
+    static const size_t Size = 8;
+
+    static inline TVec Load(const int16_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+    static inline void Store(int16_t* p, TVec v) { _mm_storeu_si128((__m128i*)p, v); }
+    static inline TVec Set(int32_t x) { return _mm_set1_epi16((int16_t)x); }
+    static inline TVec Add(TVec a, TVec b) { return _mm_adds_epi16(a, b); }
+    static inline TVec Max(TVec a, TVec b) { return _mm_max_epi16(a, b); }
+    static inline TVec Equal(TVec a, TVec b) { return _mm_cmpeq_epi16(a, b); }
+    static inline TVec Matches(const uint8_t* q, const uint8_t* r)
+    {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadl_epi64((const __m128i*)q),
+                                    _mm_loadl_epi64((const __m128i*)r));
+        return _mm_cvtepi8_epi16(eq);
+    }
+    static inline TVec Select(TVec mask, TVec a, TVec b) { return _mm_blendv_epi8(b, a, mask); }
+    static inline void StoreDirections(uint8_t* out, TVec dirs)
+    {
+        _mm_storel_epi64((__m128i*)out, _mm_packs_epi16(dirs, dirs));
+    }
+    static inline int32_t HorizontalMax(TVec m)
+    {
+        m = _mm_max_epi16(m, _mm_srli_si128(m, 8));
+        m = _mm_max_epi16(m, _mm_srli_si128(m, 4));
+        m = _mm_max_epi16(m, _mm_srli_si128(m, 2));
+        return (int16_t)_mm_extract_epi16(m, 0);
+    }
+    static inline int FirstEqual(TVec v, int32_t x)
+    {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(v, Set(x)));
+        return mask ? __builtin_ctz(mask) / 2 : -1;
+    }
+    static inline bool AnyBelow(TVec v, int32_t x)
+    {
+        return _mm_movemask_epi8(_mm_cmpgt_epi16(Set(x), v)) != 0;
+    }
+};
+
+template<>
+struct BandLanes<int32_t> {
+    typedef __m128i TVec;
+    static const size_t Size = 4;
+
+    static inline TVec Load(const int32_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+    static inline void Store(int32_t* p, TVec v) { _mm_storeu_si128((__m128i*)p, v); }
+    static inline TVec Set(int32_t x) { return _mm_set1_epi32(x); }
+    static inline TVec Add(TVec a, TVec b) { return _mm_add_epi32(a, b); }
+    static inline TVec Max(TVec a, TVec b) { return _mm_max_epi32(a, b); }
+    static inline TVec Equal(TVec a, TVec b) { return _mm_cmpeq_epi32(a, b); }
+    static inline TVec Matches(const uint8_t* q, const uint8_t* r)
+    {
+        int32_t qWord, rWord;
+        memcpy(&qWord, q, 4);
+        memcpy(&rWord, r, 4);
+        return _mm_cvtepi8_epi32(_mm_cmpeq_epi8(_mm_cvtsi32_si128(qWord), _mm_cvtsi32_si128(rWord)));
+    }
+    static inline TVec Select(TVec mask, TVec a, TVec b) { return _mm_blendv_epi8(b, a, mask); }
+    static inline void StoreDirections(uint8_t* out, TVec dirs)
+    {
+        __m128i bytes = _mm_packs_epi16(_mm_packs_epi32(dirs, dirs), dirs);
+        int32_t word = _mm_cvtsi128_si32(bytes);
+        memcpy(out, &word, 4);
+    }
+    static inline int32_t HorizontalMax(TVec m)
+    {
+        m = _mm_max_epi32(m, _mm_srli_si128(m, 8));
+        m = _mm_max_epi32(m, _mm_srli_si128(m, 4));
+        return _mm_cvtsi128_si32(m);
+    }
+    static inline int FirstEqual(TVec v, int32_t x)
+    {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi32(v, Set(x)));
+        return mask ? __builtin_ctz(mask) / 4 : -1;
+    }
+    static inline bool AnyBelow(TVec v, int32_t x)
+    {
+        return _mm_movemask_epi8(_mm_cmpgt_epi32(Set(x), v)) != 0;
+    }
+};
+#endif
+// End Utility Classes
+
+
+// Begin Utility Functions
+// Fill the banded DP matrix of the prepared sequences one anti-diagonal at a
+//    time, every cell of an anti-diagonal at once.  The band holds
+//    buffers.widths[d] cells of anti-diagonal d, and slides down or right by
+//    at most one cell per anti-diagonal to stay centered on buffers.centers,
+//    so the neighbours of every cell are the same lane or one lane over.
+//    Scores are kept relative to the best cell of the previous anti-diagonal,
+//    which keeps 16-bit lanes from overflowing.  A 16-bit run returns false,
+//    to be rerun in 32 bits, as soon as any cell inside the band and the
+//    matrix falls below a floor halfway down to the neg fill of the cells
+//    outside them: with the per-diagonal adjustments kept small enough that
+//    a candidate built on a neg cell can't reach the floor, every cell above
+//    it holds exactly the score a 32-bit run gives it, and so does
+//    everything computed from them.  The alignment is global from the start, and ends as
+//    params.end says; extensions stop early once they fall params.xDrop
+//    below their best score
+template<typename TScore>
+bool BandedAlignKernel(BandedAlignBuffers& buffers,
+                       std::vector<TScore>& cells,
+                       const size_t m,
+                       const size_t n,
+                       const BandedAlignParams& params,
+                       long& score,
+                       long& endI,
+                       long& endJ)
+{
+    typedef BandLanes<TScore> TLanes;
+    typedef typename TLanes::TVec TVec;
+
+    const size_t W = params.bandWidth;
+    const long lastDiagonal = m + n;
+    const int32_t neg = std::numeric_limits<TScore>::min() / 2;
+    const int32_t lowest = neg / 2;
+    const bool checkFloor = sizeof(TScore) < sizeof(int32_t);
+    const bool extend = params.end == BandedAlignExtend;
+
+    // Three anti-diagonals of cells, each padded with one cell on either side.
+    //    Lanes past an anti-diagonal's own width always hold neg
+    const size_t stride = W + 2;
+    cells.assign(3 * stride, neg);
+    size_t lastWidths[3] = { 0, 0, 0 };
+    buffers.bandStarts.resize(lastDiagonal + 1);
+    buffers.directions.resize((lastDiagonal + 1) * W);
+
+    // Both sequences are padded by W bytes either side, so any lane can load
+    const uint8_t* query = buffers.query.data() + W;
+    const uint8_t* reverseRef = buffers.reverseRef.data() + W;
+
+    const TVec vMatch = TLanes::Set(params.match);
+    const TVec vMismatch = TLanes::Set(params.mismatch);
+    const TVec vDiag = TLanes::Set(BandedAlignMatch);
+    const TVec vUp = TLanes::Set(BandedAlignInsertion);
+    const TVec vLeft = TLanes::Set(BandedAlignDeletion);
+
+    long base1 = 0, base2 = 0;       // Score offsets of the previous two anti-diagonals
+    long start1 = -(long)buffers.widths[0] / 2, start2 = start1;
+    int32_t max1 = 0;
+    bool found = false;
+    long bestScore = 0;
+
+    for (long d = 0; d <= lastDiagonal; ++d)
+    {
+        TScore* cur  = cells.data() + (d % 3) * stride + 1;
+        TScore* prev = cells.data() + ((d + 2) % 3) * stride + 1;
+        TScore* prev2 = cells.data() + ((d + 1) % 3) * stride + 1;
+        const size_t width = buffers.widths[d];
+        const size_t vectorWidth = (width + TLanes::Size - 1) / TLanes::Size * TLanes::Size;
+        const long half = width / 2;
+
+        // Slide down if the band's middle has fallen behind the guide, but
+        //    never so far that the band leaves the matrix
+        long start = -half;
+        if (d > 0)
+        {
+            bool down = start1 + half < buffers.centers[d];
+            if (start1 + 1 > (long)m)
+                down = false;
+            if (start1 + (long)width <= d - (long)n)
+                down = true;
+            start = start1 + (down ? 1 : 0);
+        }
+        buffers.bandStarts[d] = start;
+        long base = (d == 0 || max1 <= neg) ? base1 : base1 + max1;
+
+        long upOff = start - start1 - 1;
+        long leftOff = start - start1;
+        long diagOff = start - start2 - 1;
+        int32_t gapAdj = std::max<long>(params.gap + base1 - base, neg);
+        int32_t diagAdj = std::max<long>(base2 - base, neg);
+        if (checkFloor && std::max(gapAdj, diagAdj) + params.match >= lowest - neg)
+            return false;
+        const TVec vGapAdj = TLanes::Set(gapAdj);
+        const TVec vDiagAdj = TLanes::Set(diagAdj);
+
+        // Lane t holds cell (i, j) = (start + t, d - start - t), which scores
+        //    query[i-1] against ref[j-1], stored reversed at n - j
+        const uint8_t* q = query + start - 1;
+        const uint8_t* r = reverseRef + (long)n - d + start;
+        uint8_t* dirs = buffers.directions.data() + d * W;
+
+        for (size_t t = 0; t < vectorWidth; t += TLanes::Size)
+        {
+            TVec sub = TLanes::Select(TLanes::Matches(q + t, r + t), vMatch, vMismatch);
+            TVec diag = TLanes::Add(TLanes::Add(TLanes::Load(prev2 + t + diagOff), vDiagAdj), sub);
+            TVec up   = TLanes::Add(TLanes::Load(prev + t + upOff), vGapAdj);
+            TVec left = TLanes::Add(TLanes::Load(prev + t + leftOff), vGapAdj);
+            TVec best = TLanes::Max(diag, TLanes::Max(up, left));
+            TLanes::Store(cur + t, best);
+
+            TVec dir = TLanes::Select(TLanes::Equal(best, diag), vDiag,
+                                      TLanes::Select(TLanes::Equal(best, up), vUp, vLeft));
+            TLanes::StoreDirections(dirs + t, dir);
+        }
+        for (size_t t = width; t < std::max(vectorWidth, lastWidths[d % 3]); ++t)
+            cur[t] = neg;
+        lastWidths[d % 3] = vectorWidth;
+
+        // Clear the lanes outside the matrix, and set the edges, where the
+        //    alignment starts with all gaps
+        long tMin = std::max(-start, d - (long)n - start);
+        long tMax = std::min((long)m - start, d - start);
+        for (long t = 0; t < std::min(tMin, (long)width); ++t)
+            cur[t] = neg;
+        for (long t = std::max(tMax + 1, 0L); t < (long)width; ++t)
+            cur[t] = neg;
+        long edgeLanes[2] = { -start, d - start };
+        for (size_t e = 0; e < 2; ++e)
+        {
+            long t = edgeLanes[e];
+            if (t < 0 || t >= (long)width || t < tMin || t > tMax)
+                continue;
+            cur[t] = (TScore)std::max<long>(d * params.gap - base, neg);
+            dirs[t] = (e == 0) ? BandedAlignDeletion : BandedAlignInsertion;
+        }
+
+        // Check the cells inside the band and the matrix against the floor,
+        //    whole vectors at a time and then the ragged end
+        if (checkFloor)
+        {
+            long t = std::max(tMin, 0L);
+            const long last = std::min(tMax, (long)width - 1);
+            bool low = false;
+            for (; t + (long)TLanes::Size - 1 <= last; t += TLanes::Size)
+                low |= TLanes::AnyBelow(TLanes::Load(cur + t), lowest);
+            for (; t <= last; ++t)
+                low |= cur[t] < lowest;
+            if (low)
+                return false;
+        }
+
+        TVec vMax = TLanes::Set(neg);
+        for (size_t t = 0; t < vectorWidth; t += TLanes::Size)
+            vMax = TLanes::Max(vMax, TLanes::Load(cur + t));
+        int32_t curMax = TLanes::HorizontalMax(vMax);
+
+        if (extend)
+        {
+            // Extensions end at their best cell, and give up once they've
+            //    fallen too far below it
+            if (curMax > neg && (!found || base + curMax > bestScore))
+            {
+                for (size_t t = 0; t < vectorWidth; t += TLanes::Size)
+                {
+                    int lane = TLanes::FirstEqual(TLanes::Load(cur + t), curMax);
+                    if (lane < 0)
+                        continue;
+                    found = true;
+                    bestScore = base + curMax;
+                    endI = start + t + lane;
+                    endJ = d - endI;
+                    break;
+                }
+            }
+            if (params.xDrop > 0 && found && (curMax <= neg || base + curMax < bestScore - params.xDrop))
+                break;
+        } else {
+            // Otherwise track the best cell on the last row or column
+            long endLanes[2] = { (long)m - start, d - (long)n - start };
+            for (size_t e = 0; e < 2; ++e)
+            {
+                long t = endLanes[e];
+                if (t < 0 || t >= (long)width || t < tMin || t > tMax)
+                    continue;
+                if (params.end == BandedAlignGlobal && d != lastDiagonal)
+                    continue;
+                long value = base + cur[t];
+                if (!found || value > bestScore)
+                {
+                    found = true;
+                    bestScore = value;
+                    endI = start + t;
+                    endJ = d - endI;
+                }
+            }
+        }
+
+        max1 = curMax;
+        base2 = base1;
+        base1 = base;
+        start2 = start1;
+        start1 = start;
+    }
+
+    score = bestScore;
+    return found;
+}
+
+// Choose the band width of every anti-diagonal: each segment of the path
+//    gets minBandWidth plus its net indel, up to bandWidth, so long gaps with
+//    uneven lengths get wide bands and runs of seeds narrow ones.  Widths
+//    then ramp up and down by one cell per anti-diagonal around each segment,
+//    which, with the band following the path, grows and shrinks it evenly on
+//    both sides.  Extensions, with no end point to aim for, get the full
+//    width throughout
+void ChooseBandWidths(std::vector<size_t>& widths,
+                      const std::vector<std::pair<long, long>>& points,
+                      const long lastDiagonal,
+                      const BandedAlignParams& params)
+{
+    const size_t maxWidth = params.bandWidth;
+    const size_t minWidth = std::min(std::max<size_t>(params.minBandWidth, 1), maxWidth);
+    if (params.end == BandedAlignExtend || minWidth == maxWidth)
+    {
+        widths.assign(lastDiagonal + 1, maxWidth);
+        return;
+    }
+
+    widths.assign(lastDiagonal + 1, minWidth);
+    for (size_t p = 1; p < points.size(); ++p)
+    {
+        long queryGap = points[p].first - points[p-1].first;
+        long refGap = points[p].second - points[p-1].second;
+        size_t width = std::min<size_t>(minWidth + std::labs(queryGap - refGap), maxWidth);
+        long d1 = std::min(points[p].first + points[p].second, lastDiagonal);
+        for (long d = points[p-1].first + points[p-1].second; d <= d1; ++d)
+            widths[d] = std::max(widths[d], width);
+    }
+    for (long d = 1; d <= lastDiagonal; ++d)
+        widths[d] = std::max(widths[d], widths[d-1] - 1);
+    for (long d = lastDiagonal; d > 0; --d)
+        widths[d-1] = std::max(widths[d-1], widths[d] - 1);
+}
+
+// Align a query to a reference region along the path through the DP matrix
+//    given as points (query position, reference position), e.g. the seeds of
+//    a chain, leaving the path's start and end at the corners, and ending as
+//    params.end allows.  Sequences are ordinal values, and any pair of equal
+//    values scores as a match.  Returns the score and fills ops with the
+//    alignment, first to last, with any bases past the end of the alignment
+//    as trailing gaps
+long BandedAlign(BandedAlignBuffers& buffers,
+                 const uint8_t* query,
+                 const size_t m,
+                 const uint8_t* ref,
+                 const size_t n,
+                 const std::vector<std::pair<long, long>>& path,
+                 const BandedAlignParams& requested,
+                 std::vector<uint8_t>& ops)
+{
+    // Each anti-diagonal is scored in whole vectors, so the widest band must
+    //    be a whole number of them for either score width; 16-bit vectors
+    //    always have the most lanes
+    BandedAlignParams params = requested;
+    const size_t lanes = BandLanes<int16_t>::Size;
+    params.bandWidth = (std::max<size_t>(params.bandWidth, 1) + lanes - 1) / lanes * lanes;
+    const size_t W = params.bandWidth;
+
+    // Pad with values that never match each other or a base
+    buffers.query.assign(m + 2 * W, 0xFE);
+    std::copy(query, query + m, buffers.query.begin() + W);
+    buffers.reverseRef.assign(n + 2 * W, 0xFF);
+    std::reverse_copy(ref, ref + n, buffers.reverseRef.begin() + W);
+
+    // Interpolate the query position the path crosses each anti-diagonal at
+    buffers.centers.assign(m + n + 1, 0);
+    std::vector<std::pair<long, long>>& points = buffers.points;
+    points.clear();
+    points.push_back(std::make_pair(0L, 0L));
+    for (size_t p = 0; p < path.size(); ++p)
+        if (path[p].first >= points.back().first && path[p].second >= points.back().second &&
+            path[p].first <= (long)m && path[p].second <= (long)n)
+            points.push_back(path[p]);
+    if (params.end == BandedAlignExtend)
+    {
+        // With no end point to aim for, extensions follow the diagonal
+        long diagonal = std::min((long)m - points.back().first, (long)n - points.back().second);
+        points.push_back(std::make_pair(points.back().first + diagonal, points.back().second + diagonal));
+    }
+    points.push_back(std::make_pair((long)m, (long)n));
+    for (size_t p = 1; p < points.size(); ++p)
+    {
+        long d0 = points[p-1].first + points[p-1].second;
+        long d1 = points[p].first + points[p].second;
+        for (long d = d0; d <= d1; ++d)
+            buffers.centers[d] = (d1 == d0) ? points[p].first :
+                    points[p-1].first + (points[p].first - points[p-1].first) * (d - d0) / (d1 - d0);
+    }
+
+    long score = 0, endI = 0, endJ = 0;
+    ChooseBandWidths(buffers.widths, points, m + n, params);
+    if (!BandedAlignKernel<int16_t>(buffers, buffers.cells16, m, n, params, score, endI, endJ))
+        BandedAlignKernel<int32_t>(buffers, buffers.cells32, m, n, params, score, endI, endJ);
+
+    // Walk back from the best end cell, then add the free end gaps
+    ops.clear();
+    for (size_t i = m; (long)i > endI; --i)
+        ops.push_back(BandedAlignInsertion);
+    for (size_t j = n; (long)j > endJ; --j)
+        ops.push_back(BandedAlignDeletion);
+    long i = endI, j = endJ;
+    while (i > 0 || j > 0)
+    {
+        long d = i + j;
+        long t = i - buffers.bandStarts[d];
+        uint8_t op = (t >= 0 && t < (long)buffers.widths[d]) ? buffers.directions[d * W + t] :
+                     (i > 0 ? BandedAlignInsertion : BandedAlignDeletion);
+        if (i == 0)
+            op = BandedAlignDeletion;
+        else if (j == 0)
+            op = BandedAlignInsertion;
+        ops.push_back(op);
+        if (op != BandedAlignDeletion)
+            --i;
+        if (op != BandedAlignInsertion)
+            --j;
+    }
+    std::reverse(ops.begin(), ops.end());
+    return score;
+}
+// End Utility Functions
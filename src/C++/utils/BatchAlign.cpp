@@ -0,0 +1,225 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "utils/BandedAlign.cpp"
+
+
+// Begin Utility Classes
+// One sub-alignment to solve: a query and reference stretch, either filling
+//    the gap between two anchors of a seed chain or extending out from one,
+//    with its bases and its result kept in the pools of its GapFillBatch
+struct GapFillProblem {
+    size_t queryOffset;
+    size_t queryLength;
+    size_t refOffset;
+    size_t refLength;
+    bool extend;
+    long score;
+    size_t opsOffset;
+    size_t opsLength;
+};
+
+// A collection of gap-fill problems from any number of alignments, solved
+//    together by SolveGapFills so that each SIMD lane works on its own problem
+struct GapFillBatch {
+    std::vector<uint8_t> bases;
+    std::vector<GapFillProblem> problems;
+    std::vector<uint8_t> ops;
+
+    // Working space for SolveGapFills
+    std::vector<size_t> order;
+    std::vector<uint8_t> laneQuery;
+    std::vector<uint8_t> laneRef;
+    std::vector<int16_t> cells;
+    std::vector<uint8_t> pairOps;
+    std::vector<std::pair<long, long>> noPath;
+    BandedAlignBuffers bandBuffers;
+
+    void Clear()
+    {
+        bases.clear();
+        problems.clear();
+        ops.clear();
+    }
+
+    // Queue a problem, returning its index
+    size_t Add(const uint8_t* query, const size_t m,
+               const uint8_t* ref, const size_t n,
+               const bool extend)
+    {
+        GapFillProblem problem = { bases.size(), m, bases.size() + m, n, extend, 0, 0, 0 };
+        bases.insert(bases.end(), query, query + m);
+        bases.insert(bases.end(), ref, ref + n);
+        problems.push_back(problem);
+        return problems.size() - 1;
+    }
+};
+// End Utility Classes
+
+
+// Begin Utility Functions
+// Solve a group of up to one problem per lane with a full DP matrix, the
+//    lanes side by side so each cell of every problem is scored at once.
+//    Problems shorter than the group's longest are padded with bases that
+//    never match, and read their results from their own corner of the matrix
+void SolveGapFillLanes(GapFillBatch& batch,
+                       const size_t* group,
+                       const size_t numProblems,
+                       const BandedAlignParams& params)
+{
+    typedef BandLanes<int16_t> TLanes;
+    typedef TLanes::TVec TVec;
+    const size_t L = TLanes::Size;
+
+    size_t M = 0, N = 0;
+    for (size_t l = 0; l < numProblems; ++l)
+    {
+        M = std::max(M, batch.problems[group[l]].queryLength);
+        N = std::max(N, batch.problems[group[l]].refLength);
+    }
+
+    // Interleave the bases, so position i of every lane's query is contiguous
+    batch.laneQuery.assign(std::max<size_t>(M, 1) * L, 0xFE);
+    batch.laneRef.assign(std::max<size_t>(N, 1) * L, 0xFF);
+    for (size_t l = 0; l < numProblems; ++l)
+    {
+        const GapFillProblem& p = batch.problems[group[l]];
+        for (size_t i = 0; i < p.queryLength; ++i)
+            batch.laneQuery[i * L + l] = batch.bases[p.queryOffset + i];
+        for (size_t j = 0; j < p.refLength; ++j)
+            batch.laneRef[j * L + l] = batch.bases[p.refOffset + j];
+    }
+
+    const size_t stride = (N + 1) * L;
+    batch.cells.resize((M + 1) * stride);
+    int16_t* cells = batch.cells.data();
+    const TVec vMatch = TLanes::Set(params.match);
+    const TVec vMismatch = TLanes::Set(params.mismatch);
+    const TVec vGap = TLanes::Set(params.gap);
+
+    for (size_t j = 0; j <= N; ++j)
+        TLanes::Store(cells + j * L, TLanes::Set(j * params.gap));
+    for (size_t i = 1; i <= M; ++i)
+    {
+        int16_t* row = cells + i * stride;
+        const int16_t* above = row - stride;
+        TVec left = TLanes::Set(i * params.gap);
+        TLanes::Store(row, left);
+        const uint8_t* q = batch.laneQuery.data() + (i - 1) * L;
+        for (size_t j = 1; j <= N; ++j)
+        {
+            TVec sub = TLanes::Select(TLanes::Matches(q, batch.laneRef.data() + (j - 1) * L),
+                                      vMatch, vMismatch);
+            TVec diag = TLanes::Add(TLanes::Load(above + (j - 1) * L), sub);
+            TVec up = TLanes::Add(TLanes::Load(above + j * L), vGap);
+            left = TLanes::Max(diag, TLanes::Max(up, TLanes::Add(left, vGap)));
+            TLanes::Store(row + j * L, left);
+        }
+    }
+
+    // Read each lane's score back out and trace it back through the matrix,
+    //    preferring the same moves as the banded kernel
+    for (size_t l = 0; l < numProblems; ++l)
+    {
+        GapFillProblem& p = batch.problems[group[l]];
+        const uint8_t* query = batch.bases.data() + p.queryOffset;
+        const uint8_t* ref = batch.bases.data() + p.refOffset;
+        const size_t m = p.queryLength, n = p.refLength;
+        auto cell = [&](size_t i, size_t j) { return (long)cells[i * stride + j * L + l]; };
+
+        // Gap fills end at the corner, extensions at their best cell
+        size_t endI = m, endJ = n;
+        long best = cell(m, n);
+        if (p.extend)
+        {
+            best = 0;
+            endI = endJ = 0;
+            for (size_t i = 0; i <= m; ++i)
+                for (size_t j = 0; j <= n; ++j)
+                    if (cell(i, j) > best)
+                    {
+                        best = cell(i, j);
+                        endI = i;
+                        endJ = j;
+                    }
+        }
+        p.score = best;
+
+        std::vector<uint8_t>& ops = batch.pairOps;
+        ops.clear();
+        for (size_t i = m; i > endI; --i)
+            ops.push_back(BandedAlignInsertion);
+        for (size_t j = n; j > endJ; --j)
+            ops.push_back(BandedAlignDeletion);
+        size_t i = endI, j = endJ;
+        while (i > 0 || j > 0)
+        {
+            long value = cell(i, j);
+            uint8_t op;
+            if (i == 0)
+                op = BandedAlignDeletion;
+            else if (j == 0)
+                op = BandedAlignInsertion;
+            else if (value == cell(i-1, j-1) + (query[i-1] == ref[j-1] ? params.match : params.mismatch))
+                op = BandedAlignMatch;
+            else if (value == cell(i-1, j) + params.gap)
+                op = BandedAlignInsertion;
+            else
+                op = BandedAlignDeletion;
+            ops.push_back(op);
+            if (op != BandedAlignDeletion)
+                --i;
+            if (op != BandedAlignInsertion)
+                --j;
+        }
+        p.opsOffset = batch.ops.size();
+        p.opsLength = ops.size();
+        batch.ops.insert(batch.ops.end(), ops.rbegin(), ops.rend());
+    }
+}
+
+// Solve every queued problem.  Problems are binned by size so that the
+//    lanes of each group waste little work on padding; any longer than
+//    maxLaneLength in either sequence is aligned on its own with the banded
+//    kernel instead, since the full lane matrix grows with its square.  Only
+//    short problems, such as most gaps between seeds, are batched: the
+//    extensions past a chain's ends run thousands of bases and never are
+void SolveGapFills(GapFillBatch& batch,
+                   const BandedAlignParams& params,
+                   const size_t maxLaneLength)
+{
+    const size_t L = BandLanes<int16_t>::Size;
+    std::vector<size_t>& order = batch.order;
+    order.clear();
+
+    for (size_t p = 0; p < batch.problems.size(); ++p)
+    {
+        GapFillProblem& problem = batch.problems[p];
+        if (problem.queryLength <= maxLaneLength && problem.refLength <= maxLaneLength)
+        {
+            order.push_back(p);
+            continue;
+        }
+        BandedAlignParams pairParams = params;
+        pairParams.end = problem.extend ? BandedAlignExtend : BandedAlignGlobal;
+        problem.score = BandedAlign(batch.bandBuffers,
+                                    batch.bases.data() + problem.queryOffset, problem.queryLength,
+                                    batch.bases.data() + problem.refOffset, problem.refLength,
+                                    batch.noPath, pairParams, batch.pairOps);
+        problem.opsOffset = batch.ops.size();
+        problem.opsLength = batch.pairOps.size();
+        batch.ops.insert(batch.ops.end(), batch.pairOps.begin(), batch.pairOps.end());
+    }
+
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        const GapFillProblem& pa = batch.problems[a];
+        const GapFillProblem& pb = batch.problems[b];
+        return std::max(pa.queryLength, pa.refLength) < std::max(pb.queryLength, pb.refLength);
+    });
+    for (size_t g = 0; g < order.size(); g += L)
+        SolveGapFillLanes(batch, order.data() + g, std::min(L, order.size() - g), params);
+}
+// End Utility Functions
@@ -0,0 +1,163 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+
+// Begin Utility Classes
+// One 64-row block of Myers' bit-vector edit distance: the positive and
+//    negative vertical deltas down its column, and the distance at its last row
+struct MyersBlock {
+    uint64_t pv;
+    uint64_t mv;
+    long score;
+};
+
+// Reusable buffers for BandedEditDistance
+struct BandedEditBuffers {
+    std::vector<uint64_t> peq;
+    std::vector<MyersBlock> blocks;
+    std::vector<long> rows;
+};
+// End Utility Classes
+
+
+// Begin Utility Functions
+// Advance one block of the bit-vector DP by one text base, given the
+//    horizontal delta coming in at its top row, and return the one leaving
+//    its last row (Hyyro's formulation of Myers' algorithm)
+inline int MyersAdvanceBlock(MyersBlock& block,
+                             uint64_t eq,
+                             const uint64_t lastRow,
+                             const int hin)
+{
+    uint64_t pv = block.pv;
+    uint64_t mv = block.mv;
+    uint64_t xv = eq | mv;
+    if (hin < 0)
+        eq |= 1;
+    uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+    uint64_t ph = mv | ~(xh | pv);
+    uint64_t mh = pv & xh;
+
+    int hout = 0;
+    if (ph & lastRow)
+        hout = 1;
+    else if (mh & lastRow)
+        hout = -1;
+
+    ph <<= 1;
+    mh <<= 1;
+    if (hin < 0)
+        mh |= 1;
+    else if (hin > 0)
+        ph |= 1;
+    block.pv = mh | ~(xv | ph);
+    block.mv = ph & xv;
+    return hout;
+}
+
+// A lower bound on the edit distance of the whole query against any stretch
+//    of the reference, computed only within a band of bandWidth query rows
+//    around the path given as (query, reference) points, e.g. the seeds of a
+//    chain.  Blocks of 64 rows enter the band below as the path moves down
+//    the query and are frozen once it has passed them, so the work is
+//    proportional to the band rather than the query.  Adjacent cells of the
+//    DP matrix differ by at most one, so the cells just outside the band are
+//    taken as one better than their neighbours inside it: the row above a
+//    frozen block falls by one per base, and each block entering below
+//    starts one better per row than the row above it.  Every cell is then at
+//    most its true value, and so is the result, which is exact whenever the
+//    optimal alignments stay inside the band.  Sequences are ordinal values,
+//    with 4 (N) matching anything; returns LONG_MAX if the band never
+//    reaches the query's last row
+long BandedEditDistance(BandedEditBuffers& buffers,
+                        const uint8_t* query,
+                        const size_t m,
+                        const uint8_t* ref,
+                        const size_t n,
+                        const std::vector<std::pair<long, long>>& path,
+                        const size_t bandWidth)
+{
+    if (m == 0)
+        return 0;
+    const size_t numBlocks = (m + 63) / 64;
+    const uint64_t lastRowBit = uint64_t(1) << ((m - 1) % 64);
+    const uint64_t fullBlockLastRowBit = uint64_t(1) << 63;
+
+    // Match masks per base and block; N in either sequence matches anything
+    std::vector<uint64_t>& peq = buffers.peq;
+    peq.assign(5 * numBlocks, 0);
+    for (size_t i = 0; i < m; ++i)
+    {
+        uint64_t bit = uint64_t(1) << (i % 64);
+        if (query[i] < 4)
+            peq[query[i] * numBlocks + i / 64] |= bit;
+        else
+            for (size_t c = 0; c < 4; ++c)
+                peq[c * numBlocks + i / 64] |= bit;
+    }
+    std::fill(peq.begin() + 4 * numBlocks, peq.end(), ~uint64_t(0));
+
+    // Interpolate the query row the path passes each reference base at,
+    //    continuing diagonally beyond its ends
+    std::vector<long>& rows = buffers.rows;
+    rows.resize(n);
+    std::pair<long, long> prev(0, 0);
+    size_t next = 0;
+    for (size_t j = 0; j < n; ++j)
+    {
+        while (next < path.size() && path[next].second <= (long)j)
+            prev = path[next++];
+        long row;
+        if (next < path.size() && path[next].second > prev.second)
+            row = prev.first + (path[next].first - prev.first) * ((long)j - prev.second) /
+                               (path[next].second - prev.second);
+        else
+            row = prev.first + ((long)j - prev.second);
+        rows[j] = (j > 0) ? std::max(row, rows[j-1]) : row;
+    }
+
+    std::vector<MyersBlock>& blocks = buffers.blocks;
+    blocks.resize(numBlocks);
+    const long half = bandWidth / 2;
+    size_t lo = 0, hi = 0;
+    long best = LONG_MAX;
+
+    for (size_t j = 0; j < n; ++j)
+    {
+        // Slide the band of active blocks down to follow the path, starting
+        //    each new block exactly in the first column, or one better per
+        //    row than the one above it after that
+        long first = std::max(rows[j] - half, 0L) / 64;
+        long last = std::max(rows[j] + half, 0L) / 64 + 1;
+        lo = std::max(lo, std::min((size_t)first, numBlocks - 1));
+        size_t wantHi = std::max(lo + 1, std::min((size_t)last, numBlocks));
+        for ( ; hi < wantHi; ++hi)
+        {
+            long above = (hi == 0) ? 0 : blocks[hi-1].score;
+            long height = std::min(64 * (hi + 1), m) - 64 * hi;
+            MyersBlock block = (j == 0) ? MyersBlock{ ~uint64_t(0), 0, above + height }
+                                        : MyersBlock{ 0, ~uint64_t(0), above - height };
+            blocks[hi] = block;
+        }
+
+        // Treat the frozen rows above the band as growing better by one per base
+        int carry = (lo == 0) ? 0 : -1;
+        uint8_t base = std::min<uint8_t>(ref[j], 4);
+        const uint64_t* eqs = peq.data() + base * numBlocks;
+        for (size_t b = lo; b < hi; ++b)
+        {
+            carry = MyersAdvanceBlock(blocks[b], eqs[b],
+                                      (b + 1 == numBlocks) ? lastRowBit : fullBlockLastRowBit, carry);
+            blocks[b].score += carry;
+        }
+        if (hi == numBlocks)
+            best = std::min(best, blocks[numBlocks-1].score);
+    }
+    return best;
+}
+// End Utility Functions
@@ -0,0 +1,201 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+// Begin Utility Classes
+// Rolls a 2-bit packed hash of the last K bases along a sequence of ordinal
+//    values, only reporting a k-mer once K bases have been seen since the
+//    last N (or any other ordinal above 3).  The hash of the k-mer's
+//    reverse complement is rolled alongside it
+template<size_t K>
+struct KmerRoller {
+    static const uint64_t Mask = (K >= 32) ? ~uint64_t(0) : (uint64_t(1) << (2*K)) - 1;
+    static const size_t RcShift = 2*(K-1);
+
+    uint64_t hash;
+    uint64_t rcHash;
+    size_t valid;
+
+    KmerRoller()
+        : hash( 0 )
+        , rcHash( 0 )
+        , valid( 0 )
+    {}
+
+    // Add the next base, returning true if the last K bases form a valid k-mer
+    inline bool Push(const uint8_t ord)
+    {
+        if (ord > 3) {
+            hash = 0;
+            rcHash = 0;
+            valid = 0;
+            return false;
+        }
+        hash = ((hash << 2) | ord) & Mask;
+        rcHash = (rcHash >> 2) | (uint64_t(3 - ord) << RcShift);
+        if (valid < K)
+            ++valid;
+        return valid == K;
+    }
+};
+
+// Picks the (w,k) minimizers from a run of consecutive N-free k-mers: the
+//    k-mer with the smallest key in each window of w, the leftmost on ties.
+//    Each minimizer is reported once, however many windows it wins
+template<size_t K>
+struct MinimizerSampler {
+    struct Candidate {
+        uint64_t key;
+        size_t pos;
+    };
+
+    size_t window;
+    size_t seen;
+    size_t lastReported;
+    std::deque<Candidate> candidates;
+
+    MinimizerSampler(const size_t w)
+        : window( w )
+        , seen( 0 )
+        , lastReported( SIZE_MAX )
+    {}
+
+    // Start over at a break between runs of k-mers
+    void Reset()
+    {
+        candidates.clear();
+        seen = 0;
+        lastReported = SIZE_MAX;
+    }
+
+    // Add the k-mer at pos, calling f(pos, key) for a newly chosen minimizer
+    template<typename TFunctor>
+    inline void Push(const uint64_t key, const size_t pos, TFunctor f)
+    {
+        while (!candidates.empty() && candidates.back().key > key)
+            candidates.pop_back();
+        Candidate c = { key, pos };
+        candidates.push_back(c);
+        while (candidates.front().pos + window <= pos)
+            candidates.pop_front();
+
+        if (++seen < window || candidates.front().pos == lastReported)
+            return;
+        lastReported = candidates.front().pos;
+        f(candidates.front().pos, candidates.front().key);
+    }
+};
+// End Utility Classes
+
+
+// Begin Utility Functions
+// Scramble a 2-bit k-mer hash into a key for picking minimizers, so that
+//    low-complexity k-mers like poly-A aren't always the minimum.  The mix
+//    is invertible within 2K bits, so distinct k-mers keep distinct keys
+template<size_t K>
+inline uint64_t MinimizerKey(uint64_t hash)
+{
+    const uint64_t mask = KmerRoller<K>::Mask;
+    hash = (~hash + (hash << 21)) & mask;
+    hash = hash ^ (hash >> 24);
+    hash = ((hash + (hash << 3)) + (hash << 8)) & mask;
+    hash = hash ^ (hash >> 14);
+    hash = ((hash + (hash << 2)) + (hash << 4)) & mask;
+    hash = hash ^ (hash >> 28);
+    hash = (hash + (hash << 31)) & mask;
+    return hash;
+}
+
+// The 2-bit hash of the reverse complement of the k-mer with the given hash
+template<size_t K>
+inline uint64_t ReverseComplementHash(uint64_t hash)
+{
+    uint64_t rcHash = 0;
+    for (size_t i = 0; i < K; ++i, hash >>= 2)
+        rcHash = (rcHash << 2) | (3 - (hash & 3));
+    return rcHash;
+}
+
+// Compute the 2-bit hash of every k-mer in a sequence of ordinal values at
+//    once, for k <= 16.  Entry i describes the k-mer starting at i, and
+//    valid[i] is 0 if it contains an N.  Reverse-complement hashes are only
+//    filled in if rcHashes is non-null.  With AVX2 eight k-mers are hashed
+//    per step, one per 32-bit lane, rather than rolling one base at a time
+template<size_t K>
+size_t HashKmers(const uint8_t* ords,
+                 const size_t n,
+                 uint32_t* hashes,
+                 uint32_t* rcHashes,
+                 uint8_t* valid)
+{
+    static_assert(K <= 16, "HashKmers packs each k-mer into 32 bits");
+    if (n < K)
+        return 0;
+    const size_t numKmers = n - K + 1;
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i three = _mm256_set1_epi32(3);
+    const __m256i shuffleLowBytes = _mm256_setr_epi8(
+            0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    // Each step reads bytes [i, i+K+7), so stop while that is still in bounds
+    for ( ; i + 8 + K - 1 <= n; i += 8)
+    {
+        __m256i fwd = _mm256_setzero_si256();
+        __m256i rev = _mm256_setzero_si256();
+        __m256i bad = _mm256_setzero_si256();
+        for (size_t j = 0; j < K; ++j)
+        {
+            __m256i base = _mm256_cvtepu8_epi32(
+                    _mm_loadl_epi64(reinterpret_cast<const __m128i*>(ords + i + j)));
+            bad = _mm256_or_si256(bad, _mm256_cmpgt_epi32(base, three));
+            base = _mm256_and_si256(base, three);
+            fwd = _mm256_or_si256(_mm256_slli_epi32(fwd, 2), base);
+            if (rcHashes)
+                rev = _mm256_or_si256(rev, _mm256_sll_epi32(_mm256_sub_epi32(three, base),
+                                                             _mm_cvtsi32_si128(2*j)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(hashes + i), fwd);
+        if (rcHashes)
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(rcHashes + i), rev);
+
+        // Narrow the 32-bit N flags down to one byte per k-mer
+        __m256i flags = _mm256_shuffle_epi8(_mm256_andnot_si256(bad, _mm256_set1_epi32(1)),
+                                            shuffleLowBytes);
+        uint32_t low  = _mm256_extract_epi32(flags, 0);
+        uint32_t high = _mm256_extract_epi32(flags, 4);
+        memcpy(valid + i,     &low,  4);
+        memcpy(valid + i + 4, &high, 4);
+    }
+#endif
+
+    // Hash whatever is left one k-mer at a time
+    for ( ; i < numKmers; ++i)
+    {
+        uint32_t fwd = 0, rev = 0;
+        uint8_t ok = 1;
+        for (size_t j = 0; j < K; ++j)
+        {
+            uint8_t base = ords[i + j];
+            ok &= (base <= 3);
+            base &= 3;
+            fwd = (fwd << 2) | base;
+            rev |= uint32_t(3 - base) << (2*j);
+        }
+        hashes[i] = fwd;
+        if (rcHashes)
+            rcHashes[i] = rev;
+        valid[i] = ok;
+    }
+    return numKmers;
+}
+// End Utility Functions
@@ -0,0 +1,60 @@
+#pragma once
+#include <stddef.h>
+#include <algorithm>
+#include <vector>
+
+
+// Begin Utility Classes
+// A fixed-size array of values supporting point assignment and maximum
+//    queries over any prefix in O(log n).  Unlike a Fenwick tree, a slot
+//    can be lowered again, which is how entries are removed
+template<typename TValue>
+class MaxTree {
+
+private:
+    size_t size;
+    TValue empty;
+    std::vector<TValue> nodes;
+
+public:
+    // Size the tree for n slots, all holding the empty value
+    void Reset(const size_t n, const TValue& empty_)
+    {
+        size = n;
+        empty = empty_;
+        nodes.assign(2 * n, empty);
+    }
+
+    void Set(size_t slot, const TValue& value)
+    {
+        slot += size;
+        nodes[slot] = value;
+        for (slot >>= 1; slot > 0; slot >>= 1)
+            nodes[slot] = std::max(nodes[2*slot], nodes[2*slot+1]);
+    }
+
+    void Clear(const size_t slot)
+    {
+        Set(slot, empty);
+    }
+
+    // The largest value in slots [0, end)
+    TValue PrefixMax(size_t end) const
+    {
+        TValue best = empty;
+        for (size_t lo = size, hi = end + size; lo < hi; lo >>= 1, hi >>= 1)
+        {
+            if (lo & 1)
+                best = std::max(best, nodes[lo++]);
+            if (hi & 1)
+                best = std::max(best, nodes[--hi]);
+        }
+        return best;
+    }
+
+public:
+    MaxTree()
+        : size( 0 )
+    {}
+};
+// End Utility Classes
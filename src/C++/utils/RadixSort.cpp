@@ -0,0 +1,50 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+
+// Begin Utility Functions
+// Stable LSD radix sort of items by an unsigned integer key, 11 bits per
+//    pass.  Only as many passes as the largest key needs are made, and any
+//    pass whose digit is the same for every item is skipped.  The buffer is
+//    scratch space, kept by the caller so it can be reused between sorts
+template<typename T, typename TKeyFunctor>
+void RadixSortByKey(std::vector<T>& items,
+                    std::vector<T>& buffer,
+                    TKeyFunctor key)
+{
+    const size_t digitBits = 11;
+    const size_t numDigits = size_t(1) << digitBits;
+    const uint64_t digitMask = numDigits - 1;
+    size_t counts[numDigits];
+
+    uint64_t keyBits = 0;
+    for (size_t i = 0; i < items.size(); ++i)
+        keyBits |= key(items[i]);
+
+    buffer.resize(items.size());
+    for (size_t shift = 0; shift < 64 && (keyBits >> shift) != 0; shift += digitBits)
+    {
+        memset(counts, 0, sizeof(counts));
+        for (size_t i = 0; i < items.size(); ++i)
+            ++counts[(key(items[i]) >> shift) & digitMask];
+
+        // Nothing moves if every item shares this digit
+        if (counts[(key(items[0]) >> shift) & digitMask] == items.size())
+            continue;
+
+        size_t total = 0;
+        for (size_t d = 0; d < numDigits; ++d)
+        {
+            size_t count = counts[d];
+            counts[d] = total;
+            total += count;
+        }
+        for (size_t i = 0; i < items.size(); ++i)
+            buffer[counts[(key(items[i]) >> shift) & digitMask]++] = items[i];
+        items.swap(buffer);
+    }
+}
+// End Utility Functions
@@ -25,4 +25,11 @@ struct ReferencedSeedChainNumBasesFunctor {
         return SumReferencedSeedChainBases(chain1) > SumReferencedSeedChainBases(chain2);
     }
 } refSeedChainNumBasesComparer;
+
+struct ReferencedSeedChainScoreFunctor {
+    bool operator()(const ReferencedSeedChain& chain1, const ReferencedSeedChain& chain2)
+    {
+        return chain1.score > chain2.score;
+    }
+} refSeedChainScoreComparer;
 // End Functors
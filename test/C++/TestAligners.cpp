@@ -0,0 +1,233 @@
+// Author: Brett Bowman
+
+// Checks the banded and batched aligners against a full Needleman-Wunsch
+//    matrix on random pairs of related sequences, for every way an
+//    alignment may end, and that the alignment each returns scores as it says
+
+#include <limits.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "utils/BatchAlign.cpp"
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                          \
+    do {                                                          \
+        if (!(cond)) {                                            \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);      \
+            fprintf(stderr, __VA_ARGS__);                         \
+            fprintf(stderr, "\n");                                \
+            ++failures;                                           \
+        }                                                         \
+    } while (0)
+
+// The best score of any alignment from the start of both sequences that ends
+//    where params.end allows, from the full DP matrix
+static long FullAlignScore(const uint8_t* query, const size_t m,
+                           const uint8_t* ref, const size_t n,
+                           const BandedAlignParams& params)
+{
+    std::vector<long> cells((m + 1) * (n + 1));
+    long best = LONG_MIN;
+    for (size_t i = 0; i <= m; ++i)
+    {
+        for (size_t j = 0; j <= n; ++j)
+        {
+            long score;
+            if (i == 0 || j == 0)
+                score = (long)(i + j) * params.gap;
+            else
+            {
+                long diagonal = (query[i-1] == ref[j-1]) ? params.match : params.mismatch;
+                score = cells[(i-1) * (n+1) + j-1] + diagonal;
+                score = std::max(score, cells[(i-1) * (n+1) + j] + params.gap);
+                score = std::max(score, cells[i * (n+1) + j-1] + params.gap);
+            }
+            cells[i * (n+1) + j] = score;
+            if (params.end == BandedAlignExtend ||
+                (params.end == BandedAlignSemiGlobal && (i == m || j == n)))
+                best = std::max(best, score);
+        }
+    }
+    return (params.end == BandedAlignGlobal) ? cells[m * (n+1) + n] : best;
+}
+
+// Score a list of alignment ops, leaving out the trailing gaps any but a
+//    global alignment gets for free: those after a semi-global alignment
+//    reaches the last row or column, or after an extension's last match.
+//    Returns false if the ops don't cover both sequences, or a semi-global
+//    alignment carries on along its last row or column with anything else
+static bool ScoreAlignOps(long& score,
+                          const uint8_t* ops, const size_t numOps,
+                          const uint8_t* query, const size_t m,
+                          const uint8_t* ref, const size_t n,
+                          const BandedAlignParams& params)
+{
+    size_t last = numOps;
+    if (params.end == BandedAlignExtend)
+        while (last > 0 && ops[last-1] != BandedAlignMatch)
+            --last;
+
+    size_t i = 0, j = 0;
+    score = 0;
+    for (size_t k = 0; k < numOps; ++k)
+    {
+        bool free = (k >= last);
+        if (params.end == BandedAlignSemiGlobal && (i == m || j == n))
+        {
+            if (ops[k] != ((i == m) ? BandedAlignDeletion : BandedAlignInsertion))
+                return false;
+            free = true;
+        }
+        if (ops[k] == BandedAlignMatch)
+        {
+            if (i >= m || j >= n)
+                return false;
+            if (!free)
+                score += (query[i] == ref[j]) ? params.match : params.mismatch;
+            ++i;
+            ++j;
+            continue;
+        }
+        if (!free)
+            score += params.gap;
+        if (ops[k] == BandedAlignInsertion)
+            ++i;
+        else
+            ++j;
+    }
+    return i == m && j == n;
+}
+
+// A query read from ref with substitutions, insertions and deletions at the
+//    given rate, and a seed at each run of clean bases, as a chain would give
+static void MakeRelatedPair(std::mt19937& rng,
+                            std::vector<uint8_t>& query,
+                            std::vector<uint8_t>& ref,
+                            std::vector<std::pair<long, long>>& path,
+                            const size_t n,
+                            const int errorPercent)
+{
+    ref.resize(n);
+    for (size_t j = 0; j < n; ++j)
+        ref[j] = rng() % 4;
+    query.clear();
+    path.clear();
+    for (size_t j = 0; j < n; ++j)
+    {
+        int roll = rng() % 100;
+        if (roll < errorPercent / 3)
+            continue;
+        if (roll < 2 * errorPercent / 3)
+            query.push_back(rng() % 4);
+        query.push_back((roll < errorPercent) ? rng() % 4 : ref[j]);
+        if (j % 50 == 25)
+            path.push_back(std::make_pair((long)query.size(), (long)j + 1));
+    }
+}
+
+static void TestBandedAlign(std::mt19937& rng)
+{
+    BandedAlignBuffers buffers;
+    std::vector<uint8_t> query, ref, ops;
+    std::vector<std::pair<long, long>> path;
+    for (int trial = 0; trial < 600; ++trial)
+    {
+        BandedAlignEnd end = (BandedAlignEnd)(trial % 3);
+        MakeRelatedPair(rng, query, ref, path, 1 + rng() % 600, rng() % 30);
+        if (end != BandedAlignGlobal && trial % 2)
+            for (size_t j = 0; j < 200; ++j)
+                ref.push_back(rng() % 4);
+
+        // A band wide enough to hold the whole matrix must find the optimum;
+        //    heavy penalties push the 16-bit kernel into its 32-bit fallback
+        BandedAlignParams params = { 4, -13, -7, 2048, 32, end, 0 };
+        if (trial % 5 == 0)
+        {
+            params.mismatch = -300;
+            params.gap = -250;
+        }
+        long score = BandedAlign(buffers, query.data(), query.size(), ref.data(), ref.size(),
+                                 path, params, ops);
+        long expected = FullAlignScore(query.data(), query.size(), ref.data(), ref.size(), params);
+        CHECK(score == expected, "BandedAlign end %d, %zu x %zu: scored %ld, expected %ld",
+              (int)end, query.size(), ref.size(), score, expected);
+
+        long opsScore;
+        bool covers = ScoreAlignOps(opsScore, ops.data(), ops.size(), query.data(), query.size(),
+                                    ref.data(), ref.size(), params);
+        CHECK(covers && opsScore == score, "BandedAlign end %d: ops score %ld, returned %ld",
+              (int)end, opsScore, score);
+
+        // A narrow band or an X-drop can only miss better alignments, but what
+        //    it does return must still be scored correctly
+        BandedAlignParams narrow = params;
+        narrow.bandWidth = 64;
+        narrow.xDrop = (end == BandedAlignExtend) ? 100 : 0;
+        long narrowScore = BandedAlign(buffers, query.data(), query.size(), ref.data(), ref.size(),
+                                       path, narrow, ops);
+        covers = ScoreAlignOps(opsScore, ops.data(), ops.size(), query.data(), query.size(),
+                               ref.data(), ref.size(), narrow);
+        CHECK(narrowScore <= expected, "BandedAlign end %d: narrow band scored %ld over the optimum %ld",
+              (int)end, narrowScore, expected);
+        CHECK(covers && opsScore == narrowScore, "BandedAlign end %d: narrow ops score %ld, returned %ld",
+              (int)end, opsScore, narrowScore);
+    }
+}
+
+static void TestSolveGapFills(std::mt19937& rng)
+{
+    const size_t maxLaneLength = 256;
+    const BandedAlignParams params = { 4, -13, -7, 2048, 32, BandedAlignGlobal, 0 };
+    GapFillBatch batch;
+    std::vector<uint8_t> query, ref;
+    std::vector<std::pair<long, long>> path;
+    for (int round = 0; round < 20; ++round)
+    {
+        // A mix of short gaps batched in the lanes, longer ones aligned on
+        //    their own, and extensions of either size
+        batch.Clear();
+        for (int p = 0; p < 70; ++p)
+        {
+            size_t n = (p % 7 == 0) ? 300 + rng() % 200 : rng() % 120;
+            MakeRelatedPair(rng, query, ref, path, n, rng() % 30);
+            batch.Add(query.data(), query.size(), ref.data(), ref.size(), p % 3 == 0);
+        }
+        SolveGapFills(batch, params, maxLaneLength);
+
+        for (size_t p = 0; p < batch.problems.size(); ++p)
+        {
+            const GapFillProblem& problem = batch.problems[p];
+            const uint8_t* q = batch.bases.data() + problem.queryOffset;
+            const uint8_t* r = batch.bases.data() + problem.refOffset;
+            BandedAlignParams pairParams = params;
+            pairParams.end = problem.extend ? BandedAlignExtend : BandedAlignGlobal;
+
+            long expected = FullAlignScore(q, problem.queryLength, r, problem.refLength, pairParams);
+            CHECK(problem.score == expected, "SolveGapFills %s %zu x %zu: scored %ld, expected %ld",
+                  problem.extend ? "extension" : "gap", problem.queryLength, problem.refLength,
+                  problem.score, expected);
+
+            long opsScore;
+            bool covers = ScoreAlignOps(opsScore, batch.ops.data() + problem.opsOffset, problem.opsLength,
+                                        q, problem.queryLength, r, problem.refLength, pairParams);
+            CHECK(covers && opsScore == problem.score, "SolveGapFills: ops score %ld, returned %ld",
+                  opsScore, problem.score);
+        }
+    }
+}
+
+int main()
+{
+    std::mt19937 rng(20141110);
+    TestBandedAlign(rng);
+    TestSolveGapFills(rng);
+    if (failures > 0)
+        fprintf(stderr, "%d check(s) failed\n", failures);
+    return failures > 0;
+}
@@ -0,0 +1,239 @@
+// Author: Brett Bowman
+
+// Checks a q-gram index built in memory against a direct count of the
+//    reference's q-grams, that saving and mapping it back gives the same
+//    index, and that stale, truncated or corrupt index files are rejected
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "QGramIndex.hpp"
+#include "ReferenceSet.hpp"
+
+using namespace srsli;
+
+typedef FindSeedsConfig<8> TConfig;
+typedef QGramIndex<TConfig> TIndex;
+typedef std::vector<std::vector<QGramHit>> TBuckets;
+
+static const size_t K = TConfig::Size;
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                          \
+    do {                                                          \
+        if (!(cond)) {                                            \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);      \
+            fprintf(stderr, __VA_ARGS__);                         \
+            fprintf(stderr, "\n");                                \
+            ++failures;                                           \
+        }                                                         \
+    } while (0)
+
+// A few random contigs with a run of Ns and a repeat, so that some q-grams
+//    are frequent enough to mask, optionally with a single base changed
+static void WriteReference(const std::string& filename, const bool changed)
+{
+    std::mt19937 rng(1110);
+    const char bases[] = "ACGT";
+    const size_t lengths[] = { 3000, 1500, 800 };
+    std::string repeat;
+    for (size_t i = 0; i < 40; ++i)
+        repeat += bases[rng() % 4];
+
+    std::ofstream out(filename.c_str());
+    for (size_t c = 0; c < 3; ++c)
+    {
+        std::string seq;
+        for (size_t i = 0; i < lengths[c]; ++i)
+            seq += bases[rng() % 4];
+        for (size_t r = 0; r < 5; ++r)
+            seq.replace(100 + 120 * r, repeat.size(), repeat);
+        if (c == 1)
+            seq.replace(700, 25, std::string(25, 'N'));
+        if (changed && c == 2)
+            seq[400] = (seq[400] == 'A') ? 'C' : 'A';
+        out << ">contig" << c << "\n";
+        for (size_t i = 0; i < seq.size(); i += 60)
+            out << seq.substr(i, 60) << "\n";
+    }
+}
+
+// The hits of every q-gram in the first numRecords records, found directly
+static TBuckets CountQGrams(const ReferenceSet& refSet, const size_t numRecords)
+{
+    TBuckets buckets(size_t(1) << (2 * K));
+    for (size_t recIdx = 0; recIdx < numRecords; ++recIdx)
+    {
+        const ReferenceView& view = refSet.Records[recIdx].seq;
+        std::vector<uint8_t> ords(view.Length());
+        view.CopyOrdValues(ords.data(), 0, ords.size());
+        for (size_t pos = 0; pos + K <= ords.size(); ++pos)
+        {
+            uint64_t hash = 0;
+            bool valid = true;
+            for (size_t i = 0; i < K; ++i)
+            {
+                valid = valid && ords[pos + i] < 4;
+                hash = (hash << 2) | (ords[pos + i] & 3);
+            }
+            if (valid)
+                buckets[hash].push_back(QGramHit(recIdx, pos));
+        }
+    }
+    return buckets;
+}
+
+// Whether every bucket of the index holds exactly the expected hits, in order
+static bool SameBuckets(const TIndex& index, const TBuckets& expected)
+{
+    if (index.DirLength() != expected.size() + 1)
+        return false;
+    for (size_t h = 0; h < expected.size(); ++h)
+    {
+        std::pair<const QGramHit*, const QGramHit*> hits = index.Occurrences(h);
+        if ((size_t)(hits.second - hits.first) != expected[h].size())
+            return false;
+        for (size_t i = 0; i < expected[h].size(); ++i)
+            if (hits.first[i].seq != expected[h][i].seq || hits.first[i].pos != expected[h][i].pos)
+                return false;
+    }
+    return true;
+}
+
+static bool SameIndex(const TIndex& a, const TIndex& b)
+{
+    if (a.DirLength() != b.DirLength() || a.SALength() != b.SALength() ||
+        a.ForwardOnly() != b.ForwardOnly() ||
+        memcmp(&a.MaskStats(), &b.MaskStats(), sizeof(QGramMaskStats)) != 0)
+        return false;
+    for (size_t h = 0; h + 1 < a.DirLength(); ++h)
+    {
+        std::pair<const QGramHit*, const QGramHit*> x = a.Occurrences(h);
+        std::pair<const QGramHit*, const QGramHit*> y = b.Occurrences(h);
+        if (x.second - x.first != y.second - y.first)
+            return false;
+        for (const QGramHit *p = x.first, *q = y.first; p != x.second; ++p, ++q)
+            if (p->seq != q->seq || p->pos != q->pos)
+                return false;
+    }
+    return true;
+}
+
+static std::string ReadFile(const std::string& filename)
+{
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static void WriteFile(const std::string& filename, const std::string& contents)
+{
+    std::ofstream out(filename.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(contents.data(), contents.size());
+}
+
+static bool OpenFails(const std::string& filename, const ReferenceSet& refSet)
+{
+    TIndex index;
+    try {
+        index.Open(filename, refSet);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+static void TestBuild(const ReferenceSet& refSet)
+{
+    TIndex index;
+    index.Build(refSet);
+    CHECK(SameBuckets(index, CountQGrams(refSet, refSet.Records.size())),
+          "both-strand index doesn't match a direct count");
+
+    TIndex forward;
+    forward.Build(refSet, true);
+    CHECK(forward.ForwardOnly(), "forward-only index isn't marked as such");
+    CHECK(SameBuckets(forward, CountQGrams(refSet, refSet.Length())),
+          "forward-only index doesn't match a direct count");
+
+    // Masking empties exactly the buckets over the cutoff
+    const uint64_t cutoff = 3;
+    TBuckets expected = CountQGrams(refSet, refSet.Records.size());
+    size_t numMasked = 0;
+    for (size_t h = 0; h < expected.size(); ++h)
+        if (expected[h].size() > cutoff)
+        {
+            expected[h].clear();
+            ++numMasked;
+        }
+    TIndex masked;
+    masked.Build(refSet, false, cutoff);
+    CHECK(numMasked > 0, "the test reference has no q-gram to mask");
+    CHECK(masked.MaskStats().maskedQGrams == numMasked, "masked %llu q-grams, expected %zu",
+          (unsigned long long)masked.MaskStats().maskedQGrams, numMasked);
+    CHECK(SameBuckets(masked, expected), "masked index doesn't match a direct count");
+}
+
+static void TestSaveAndOpen(const ReferenceSet& refSet, const ReferenceSet& changedSet)
+{
+    const std::string filename = "TestQGramIndex.idx";
+    for (int forwardOnly = 0; forwardOnly < 2; ++forwardOnly)
+    {
+        TIndex built;
+        built.Build(refSet, forwardOnly, 4);
+        built.Save(filename, refSet);
+
+        TIndex opened;
+        opened.Open(filename, refSet);
+        CHECK(SameIndex(built, opened), "index mapped from %s differs from the one saved (forward only %d)",
+              filename.c_str(), forwardOnly);
+    }
+
+    CHECK(OpenFails(filename, changedSet), "opened an index built from a different reference");
+
+    const std::string saved = ReadFile(filename);
+    const std::string damaged = "TestQGramIndex.damaged.idx";
+    WriteFile(damaged, saved.substr(0, saved.size() - 100));
+    CHECK(OpenFails(damaged, refSet), "opened a truncated index");
+
+    std::string corrupt = saved;
+    uint64_t dirLength = (uint64_t(1) << (2 * K)) / 2;
+    memcpy(&corrupt[offsetof(QGramIndexHeader, dirLength)], &dirLength, sizeof(dirLength));
+    WriteFile(damaged, corrupt);
+    CHECK(OpenFails(damaged, refSet), "opened an index with a short directory");
+
+    corrupt = saved;
+    uint64_t saOffset = UINT64_MAX - 8;
+    memcpy(&corrupt[offsetof(QGramIndexHeader, saOffset)], &saOffset, sizeof(saOffset));
+    WriteFile(damaged, corrupt);
+    CHECK(OpenFails(damaged, refSet), "opened an index whose suffix array lies past the end of the file");
+
+    remove(filename.c_str());
+    remove(damaged.c_str());
+}
+
+int main()
+{
+    WriteReference("TestQGramIndex.fasta", false);
+    WriteReference("TestQGramIndex.changed.fasta", true);
+    ReferenceSet refSet("TestQGramIndex.fasta");
+    ReferenceSet changedSet("TestQGramIndex.changed.fasta");
+
+    TestBuild(refSet);
+    TestSaveAndOpen(refSet, changedSet);
+
+    remove("TestQGramIndex.fasta");
+    remove("TestQGramIndex.changed.fasta");
+    if (failures > 0)
+        fprintf(stderr, "%d check(s) failed\n", failures);
+    return failures > 0;
+}
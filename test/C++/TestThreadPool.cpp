@@ -0,0 +1,138 @@
+// Author: Brett Bowman
+
+// Checks that the pool runs every task it's given and passes on their
+//    errors, and that task groups waited for from inside the pool's own
+//    tasks finish without tying up the workers
+
+#include <stdio.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include "ThreadPool.hpp"
+
+using namespace srsli;
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                          \
+    do {                                                          \
+        if (!(cond)) {                                            \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);      \
+            fprintf(stderr, __VA_ARGS__);                         \
+            fprintf(stderr, "\n");                                \
+            ++failures;                                           \
+        }                                                         \
+    } while (0)
+
+static void TestSubmitAndWait()
+{
+    ThreadPool pool(4);
+    CHECK(pool.Size() == 4, "pool of 4 has %zu workers", pool.Size());
+    CHECK(pool.CurrentWorker() == -1, "outside thread is worker %d", pool.CurrentWorker());
+
+    std::atomic<size_t> ran(0);
+    std::atomic<size_t> badWorkers(0);
+    for (size_t i = 0; i < 10000; ++i)
+    {
+        pool.Submit([&]() {
+            int worker = pool.CurrentWorker();
+            if (worker < 0 || worker >= (int)pool.Size())
+                ++badWorkers;
+            ++ran;
+        });
+        pool.Wait(64);
+    }
+    pool.Wait();
+    CHECK(ran == 10000, "ran %zu of 10000 tasks", ran.load());
+    CHECK(badWorkers == 0, "%zu tasks ran outside a worker slot", badWorkers.load());
+}
+
+static void TestErrors()
+{
+    ThreadPool pool(3);
+    std::atomic<size_t> ran(0);
+    for (size_t i = 0; i < 100; ++i)
+        pool.Submit([&, i]() {
+            ++ran;
+            if (i % 10 == 3)
+                throw std::runtime_error("task failed");
+        });
+
+    bool threw = false;
+    try {
+        pool.Wait();
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw, "Wait didn't re-throw a task's error");
+    CHECK(ran == 100, "ran %zu of 100 tasks despite errors", ran.load());
+
+    // The error is only reported once
+    pool.Submit([&]() { ++ran; });
+    threw = false;
+    try {
+        pool.Wait();
+    } catch (...) {
+        threw = true;
+    }
+    CHECK(!threw, "Wait re-threw an error it had already reported");
+}
+
+static void TestNestedGroups()
+{
+    // More outer tasks than workers, each waiting on a group of its own, so
+    //    every worker ends up waiting inside a task at once
+    ThreadPool pool(2);
+    const size_t numOuter = 16, numInner = 50;
+    std::vector<size_t> sums(numOuter, 0);
+    for (size_t o = 0; o < numOuter; ++o)
+        pool.Submit([&, o]() {
+            std::vector<size_t> parts(numInner, 0);
+            TaskGroup group(pool);
+            for (size_t i = 0; i < numInner; ++i)
+                group.Run([&, i]() { parts[i] = o * numInner + i; });
+            group.Wait();
+            for (size_t i = 0; i < numInner; ++i)
+                sums[o] += parts[i];
+        });
+    pool.Wait();
+
+    for (size_t o = 0; o < numOuter; ++o)
+    {
+        size_t expected = o * numInner * numInner + numInner * (numInner - 1) / 2;
+        CHECK(sums[o] == expected, "outer task %zu summed %zu, expected %zu", o, sums[o], expected);
+    }
+
+    // A group passes its own tasks' errors on to its waiter, not to the pool
+    std::atomic<size_t> ran(0);
+    bool threw = false;
+    {
+        TaskGroup group(pool);
+        for (size_t i = 0; i < 20; ++i)
+            group.Run([&, i]() {
+                ++ran;
+                if (i == 7)
+                    throw std::runtime_error("group task failed");
+            });
+        try {
+            group.Wait();
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+    }
+    CHECK(threw, "TaskGroup::Wait didn't re-throw a task's error");
+    CHECK(ran == 20, "ran %zu of 20 group tasks despite an error", ran.load());
+    pool.Wait();
+}
+
+int main()
+{
+    TestSubmitAndWait();
+    TestErrors();
+    TestNestedGroups();
+    if (failures > 0)
+        fprintf(stderr, "%d check(s) failed\n", failures);
+    return failures > 0;
+}